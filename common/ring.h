@@ -0,0 +1,406 @@
+#ifndef RING_H
+#define RING_H
+
+/*
+ * Header-only bounded ring buffers, specialized at compile time:
+ *
+ *   RING_DEFINE(name, type, capacity, policy)
+ *
+ * defines the ring type name for elements of type and these functions:
+ *
+ *   bool nameInit(name *r, long size);  false if the buffer can not be had
+ *   void nameDestroy(name *r);
+ *   void nameClear(name *r);            empties it, while no thread uses it
+ *   bool nameTryPush(name *r, const type *in, long *slot);  false when full
+ *   bool nameTryPop(name *r, type *out, long *slot);        false when empty
+ *   long nameTryPushN(name *r, const type *in, long n, long *slot);
+ *   long nameTryPopN(name *r, type *out, long n, long *slot);
+ *   long nameLen(name *r);
+ *
+ * The N versions move as many of the n elements as there is room or there are
+ * elements for in one step and return how many, 0 when full or empty. They
+ * take consecutive slots, the first one is returned through slot and the ring
+ * wraps after the last slot.
+ *
+ * With a capacity > 0 the ring always has that many slots and the size given
+ * to Init is ignored; a power of two capacity then wraps with a constant mask
+ * and any other with a constant modulo. With capacity 0 the size comes from
+ * Init, and power of two sizes wrap with a mask kept in the ring.
+ *
+ * The policy says who may call TryPush and TryPop at the same time:
+ *
+ *   RING_LOCKED  nobody, the caller serializes every call, e.g. holds a mutex
+ *   RING_SPSC    one producer and one consumer thread, without a lock
+ *   RING_MPMC    any number of threads, Vyukov's sequence number per slot
+ *
+ * Blocking on a full or empty ring is left to the caller.
+ */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_CACHE_LINE 64
+#define RING_ALIGNED __attribute__((aligned(RING_CACHE_LINE)))
+
+/**
+ * size - 1 when size is a power of two, else 0
+ */
+static inline size_t ringMask(size_t size) {
+  return (size & (size - 1)) == 0 ? size - 1 : 0;
+}
+
+/**
+ * Masking is cheaper than the modulo, so power of two sizes use it
+ */
+static inline size_t ringIndex(size_t pos, size_t size, size_t mask) {
+  return mask ? pos & mask : pos % size;
+}
+
+/**
+ * Zeroed allocation aligned and padded to whole cache lines
+ */
+static inline void *ringAlloc(size_t size) {
+  size = (size + RING_CACHE_LINE - 1) / RING_CACHE_LINE * RING_CACHE_LINE;
+  void *p = aligned_alloc(RING_CACHE_LINE, size);
+  if (p != NULL)
+    memset(p, 0, size);
+  return p;
+}
+
+// Folds to a mask or a modulo by a constant when capacity is one
+#define RING_WRAP(r, pos, capacity)                                            \
+  ((capacity) > 0 ? (((capacity) & ((capacity)-1)) == 0                        \
+                         ? (size_t)(pos) & ((size_t)(capacity)-1)              \
+                         : (size_t)(pos) % (size_t)(capacity))                 \
+                  : ringIndex((pos), (r)->size, (r)->mask))
+
+/**
+ * Copies n elements into the ring buf of size slots from slot at on, the
+ * ones past the end to its start
+ */
+static inline void ringCopyIn(void *buf, size_t size, size_t at,
+                              const void *in, size_t n, size_t elem) {
+  size_t first = n < size - at ? n : size - at;
+  memcpy((char *)buf + at * elem, in, first * elem);
+  memcpy(buf, (const char *)in + first * elem, (n - first) * elem);
+}
+
+static inline void ringCopyOut(void *out, const void *buf, size_t size,
+                               size_t at, size_t n, size_t elem) {
+  size_t first = n < size - at ? n : size - at;
+  memcpy(out, (const char *)buf + at * elem, first * elem);
+  memcpy((char *)out + first * elem, buf, (n - first) * elem);
+}
+
+#define RING_SIZE(r, capacity) ((capacity) > 0 ? (size_t)(capacity) : (r)->size)
+
+#define RING_DEFINE(name, type, capacity, policy)                              \
+  RING_DEFINE_##policy(name, type, capacity)
+
+// head and tail count every pop and push, so tail - head is the length
+#define RING_DEFINE_RING_LOCKED(name, type, capacity)                          \
+  typedef struct {                                                             \
+    size_t head, tail;                                                         \
+    size_t size, mask;                                                         \
+    type *buf;                                                                 \
+  } name;                                                                      \
+                                                                               \
+  static inline bool name##Init(name *r, long size) {                          \
+    r->size = (capacity) > 0 ? (size_t)(capacity) : (size_t)size;              \
+    r->mask = ringMask(r->size);                                               \
+    r->head = r->tail = 0;                                                     \
+    r->buf = r->size > 0 ? (type *)ringAlloc(r->size * sizeof(type)) : NULL;   \
+    return r->buf != NULL;                                                     \
+  }                                                                            \
+                                                                               \
+  static inline void name##Destroy(name *r) { free(r->buf); }                  \
+                                                                               \
+  static inline void name##Clear(name *r) { r->head = r->tail = 0; }           \
+                                                                               \
+  static inline long name##Len(name *r) { return r->tail - r->head; }          \
+                                                                               \
+  static inline bool name##TryPush(name *r, const type *in, long *slot) {      \
+    if (r->tail - r->head == RING_SIZE(r, capacity))                           \
+      return false;                                                            \
+    *slot = RING_WRAP(r, r->tail, capacity);                                   \
+    r->buf[*slot] = *in;                                                       \
+    r->tail++;                                                                 \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##TryPop(name *r, type *out, long *slot) {            \
+    if (r->tail == r->head)                                                    \
+      return false;                                                            \
+    *slot = RING_WRAP(r, r->head, capacity);                                   \
+    *out = r->buf[*slot];                                                      \
+    r->head++;                                                                 \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline long name##TryPushN(name *r, const type *in, long n,           \
+                                    long *slot) {                              \
+    size_t room = RING_SIZE(r, capacity) - (r->tail - r->head);                \
+    if ((size_t)n > room)                                                      \
+      n = room;                                                                \
+    *slot = RING_WRAP(r, r->tail, capacity);                                   \
+    ringCopyIn(r->buf, RING_SIZE(r, capacity), *slot, in, n, sizeof(type));    \
+    r->tail += n;                                                              \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline long name##TryPopN(name *r, type *out, long n, long *slot) {   \
+    if ((size_t)n > r->tail - r->head)                                         \
+      n = r->tail - r->head;                                                   \
+    *slot = RING_WRAP(r, r->head, capacity);                                   \
+    ringCopyOut(out, r->buf, RING_SIZE(r, capacity), *slot, n, sizeof(type));  \
+    r->head += n;                                                              \
+    return n;                                                                  \
+  }
+
+// Each side keeps a copy of the other side's counter and only loads the
+// shared one when the copy says full or empty
+#define RING_DEFINE_RING_SPSC(name, type, capacity)                            \
+  typedef struct {                                                             \
+    atomic_size_t head RING_ALIGNED; /* consumer */                            \
+    size_t cachedTail;                                                         \
+    atomic_size_t tail RING_ALIGNED; /* producer */                            \
+    size_t cachedHead;                                                         \
+    size_t size RING_ALIGNED, mask;                                            \
+    type *buf;                                                                 \
+  } name;                                                                      \
+                                                                               \
+  static inline bool name##Init(name *r, long size) {                          \
+    r->size = (capacity) > 0 ? (size_t)(capacity) : (size_t)size;              \
+    r->mask = ringMask(r->size);                                               \
+    atomic_init(&r->head, 0);                                                  \
+    atomic_init(&r->tail, 0);                                                  \
+    r->cachedHead = r->cachedTail = 0;                                         \
+    r->buf = r->size > 0 ? (type *)ringAlloc(r->size * sizeof(type)) : NULL;   \
+    return r->buf != NULL;                                                     \
+  }                                                                            \
+                                                                               \
+  static inline void name##Destroy(name *r) { free(r->buf); }                  \
+                                                                               \
+  static inline void name##Clear(name *r) {                                    \
+    atomic_store(&r->head, 0);                                                 \
+    atomic_store(&r->tail, 0);                                                 \
+    r->cachedHead = r->cachedTail = 0;                                         \
+  }                                                                            \
+                                                                               \
+  static inline long name##Len(name *r) {                                      \
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);           \
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);           \
+    return t > h ? (long)(t - h) : 0;                                          \
+  }                                                                            \
+                                                                               \
+  static inline bool name##TryPush(name *r, const type *in, long *slot) {      \
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);           \
+    if (t - r->cachedHead == RING_SIZE(r, capacity)) {                         \
+      r->cachedHead = atomic_load_explicit(&r->head, memory_order_acquire);    \
+      if (t - r->cachedHead == RING_SIZE(r, capacity))                         \
+        return false;                                                          \
+    }                                                                          \
+    *slot = RING_WRAP(r, t, capacity);                                         \
+    r->buf[*slot] = *in;                                                       \
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);              \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##TryPop(name *r, type *out, long *slot) {            \
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);           \
+    if (h == r->cachedTail) {                                                  \
+      r->cachedTail = atomic_load_explicit(&r->tail, memory_order_acquire);    \
+      if (h == r->cachedTail)                                                  \
+        return false;                                                          \
+    }                                                                          \
+    *slot = RING_WRAP(r, h, capacity);                                         \
+    *out = r->buf[*slot];                                                      \
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);              \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline long name##TryPushN(name *r, const type *in, long n,           \
+                                    long *slot) {                              \
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);           \
+    if (t - r->cachedHead + n > RING_SIZE(r, capacity))                        \
+      r->cachedHead = atomic_load_explicit(&r->head, memory_order_acquire);    \
+    size_t room = RING_SIZE(r, capacity) - (t - r->cachedHead);                \
+    if ((size_t)n > room)                                                      \
+      n = room;                                                                \
+    *slot = RING_WRAP(r, t, capacity);                                         \
+    ringCopyIn(r->buf, RING_SIZE(r, capacity), *slot, in, n, sizeof(type));    \
+    atomic_store_explicit(&r->tail, t + n, memory_order_release);              \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline long name##TryPopN(name *r, type *out, long n, long *slot) {   \
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);           \
+    if (r->cachedTail - h < (size_t)n)                                         \
+      r->cachedTail = atomic_load_explicit(&r->tail, memory_order_acquire);    \
+    if ((size_t)n > r->cachedTail - h)                                         \
+      n = r->cachedTail - h;                                                   \
+    *slot = RING_WRAP(r, h, capacity);                                         \
+    ringCopyOut(out, r->buf, RING_SIZE(r, capacity), *slot, n, sizeof(type));  \
+    atomic_store_explicit(&r->head, h + n, memory_order_release);              \
+    return n;                                                                  \
+  }
+
+// seq == pos means the cell is free for the producer at pos, seq == pos + 1
+// that it is full for the consumer at pos. A thread claims a position with
+// one CAS on the enqueue or dequeue counter. With one cell both would mean
+// the same, so Init wants at least two.
+#define RING_DEFINE_RING_MPMC(name, type, capacity)                            \
+  typedef struct {                                                             \
+    atomic_size_t seq;                                                         \
+    type data;                                                                 \
+  } RING_ALIGNED name##Cell;                                                   \
+                                                                               \
+  typedef struct {                                                             \
+    atomic_size_t enqueuePos RING_ALIGNED;                                     \
+    atomic_size_t dequeuePos RING_ALIGNED;                                     \
+    name##Cell *cells RING_ALIGNED;                                            \
+    size_t size, mask;                                                         \
+  } name;                                                                      \
+                                                                               \
+  static inline void name##Clear(name *r) {                                    \
+    atomic_store(&r->enqueuePos, 0);                                           \
+    atomic_store(&r->dequeuePos, 0);                                           \
+    for (size_t i = 0; i < r->size; i++)                                       \
+      atomic_store_explicit(&r->cells[i].seq, i, memory_order_relaxed);        \
+  }                                                                            \
+                                                                               \
+  static inline bool name##Init(name *r, long size) {                          \
+    r->size = (capacity) > 0 ? (size_t)(capacity) : (size_t)size;              \
+    r->mask = ringMask(r->size);                                               \
+    r->cells = r->size >= 2                                                    \
+                   ? (name##Cell *)ringAlloc(r->size * sizeof(name##Cell))     \
+                   : NULL;                                                     \
+    if (r->cells == NULL)                                                      \
+      return false;                                                            \
+    name##Clear(r);                                                            \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void name##Destroy(name *r) { free(r->cells); }                \
+                                                                               \
+  static inline long name##Len(name *r) {                                      \
+    size_t d = atomic_load_explicit(&r->dequeuePos, memory_order_relaxed);     \
+    size_t e = atomic_load_explicit(&r->enqueuePos, memory_order_relaxed);     \
+    return e > d ? (long)(e - d) : 0;                                          \
+  }                                                                            \
+                                                                               \
+  static inline bool name##TryPush(name *r, const type *in, long *slot) {      \
+    name##Cell *cell;                                                          \
+    size_t pos = atomic_load_explicit(&r->enqueuePos, memory_order_relaxed);   \
+                                                                               \
+    for (;;) {                                                                 \
+      cell = &r->cells[RING_WRAP(r, pos, capacity)];                           \
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);     \
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;                            \
+      if (dif == 0) {                                                          \
+        if (atomic_compare_exchange_weak_explicit(&r->enqueuePos, &pos,        \
+                                                  pos + 1,                     \
+                                                  memory_order_relaxed,        \
+                                                  memory_order_relaxed))       \
+          break;                                                               \
+      } else if (dif < 0) {                                                    \
+        return false;                                                          \
+      } else {                                                                 \
+        pos = atomic_load_explicit(&r->enqueuePos, memory_order_relaxed);      \
+      }                                                                        \
+    }                                                                          \
+    cell->data = *in;                                                          \
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);          \
+    *slot = cell - r->cells;                                                   \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##TryPop(name *r, type *out, long *slot) {            \
+    name##Cell *cell;                                                          \
+    size_t pos = atomic_load_explicit(&r->dequeuePos, memory_order_relaxed);   \
+                                                                               \
+    for (;;) {                                                                 \
+      cell = &r->cells[RING_WRAP(r, pos, capacity)];                           \
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);     \
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);                      \
+      if (dif == 0) {                                                          \
+        if (atomic_compare_exchange_weak_explicit(&r->dequeuePos, &pos,        \
+                                                  pos + 1,                     \
+                                                  memory_order_relaxed,        \
+                                                  memory_order_relaxed))       \
+          break;                                                               \
+      } else if (dif < 0) {                                                    \
+        return false;                                                          \
+      } else {                                                                 \
+        pos = atomic_load_explicit(&r->dequeuePos, memory_order_relaxed);      \
+      }                                                                        \
+    }                                                                          \
+    *out = cell->data;                                                         \
+    atomic_store_explicit(&cell->seq, pos + RING_SIZE(r, capacity),            \
+                          memory_order_release);                               \
+    *slot = cell - r->cells;                                                   \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* The cells from pos on whose seq is ready + their offset */                \
+  static inline long name##Ready(name *r, size_t pos, size_t ready, long n) {  \
+    long k = 0;                                                                \
+    for (; k < n; k++) {                                                       \
+      name##Cell *cell = &r->cells[RING_WRAP(r, pos + k, capacity)];           \
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);     \
+      if (seq != ready + k)                                                    \
+        break;                                                                 \
+    }                                                                          \
+    return k;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Claims the run of ready cells with one CAS, 0 when the first is not */    \
+  static inline long name##Claim(name *r, atomic_size_t *counter, long n,      \
+                                 size_t *pos, size_t offset) {                 \
+    *pos = atomic_load_explicit(counter, memory_order_relaxed);                \
+    for (;;) {                                                                 \
+      long k = name##Ready(r, *pos, *pos + offset, n);                         \
+      if (k == 0) {                                                            \
+        name##Cell *cell = &r->cells[RING_WRAP(r, *pos, capacity)];            \
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);   \
+        if ((intptr_t)seq - (intptr_t)(*pos + offset) < 0)                     \
+          return 0;                                                            \
+        *pos = atomic_load_explicit(counter, memory_order_relaxed);            \
+      } else if (atomic_compare_exchange_weak_explicit(                        \
+                     counter, pos, *pos + k, memory_order_relaxed,             \
+                     memory_order_relaxed)) {                                  \
+        return k;                                                              \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline long name##TryPushN(name *r, const type *in, long n,           \
+                                    long *slot) {                              \
+    size_t pos;                                                                \
+    long k = name##Claim(r, &r->enqueuePos, n, &pos, 0);                       \
+    for (long i = 0; i < k; i++) {                                             \
+      name##Cell *cell = &r->cells[RING_WRAP(r, pos + i, capacity)];           \
+      cell->data = in[i];                                                      \
+      atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);    \
+    }                                                                          \
+    *slot = RING_WRAP(r, pos, capacity);                                       \
+    return k;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline long name##TryPopN(name *r, type *out, long n, long *slot) {   \
+    size_t pos;                                                                \
+    long k = name##Claim(r, &r->dequeuePos, n, &pos, 1);                       \
+    for (long i = 0; i < k; i++) {                                             \
+      name##Cell *cell = &r->cells[RING_WRAP(r, pos + i, capacity)];           \
+      out[i] = cell->data;                                                     \
+      atomic_store_explicit(&cell->seq, pos + i + RING_SIZE(r, capacity),      \
+                            memory_order_release);                             \
+    }                                                                          \
+    *slot = RING_WRAP(r, pos, capacity);                                       \
+    return k;                                                                  \
+  }
+
+#endif
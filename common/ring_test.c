@@ -0,0 +1,195 @@
+/*
+ * Checks every policy of ring.h with a power of two and an odd capacity, both
+ * fixed at compile time and given to Init, and MPMC and SPSC under threads.
+ * Exits 1 when a check fails.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "ring.h"
+
+// Items every thread of the threaded checks moves
+#define THREAD_ITEMS 200000
+#define THREADS 4
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond);        \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+RING_DEFINE(lockedPow, long, 8, RING_LOCKED)
+RING_DEFINE(lockedOdd, long, 6, RING_LOCKED)
+RING_DEFINE(lockedAny, long, 0, RING_LOCKED)
+RING_DEFINE(spscPow, long, 8, RING_SPSC)
+RING_DEFINE(spscOdd, long, 6, RING_SPSC)
+RING_DEFINE(spscAny, long, 0, RING_SPSC)
+RING_DEFINE(mpmcPow, long, 8, RING_MPMC)
+RING_DEFINE(mpmcOdd, long, 6, RING_MPMC)
+RING_DEFINE(mpmcAny, long, 0, RING_MPMC)
+
+/*
+ * Fills and drains the ring 3 * size times, starting one slot later every
+ * round so that every fill wraps somewhere else, then does the same with
+ * batches that ask for more than there is room or there are items for.
+ * pos counts the pushes, so the slot of the next one is pos % size.
+ */
+#define RING_TEST(name)                                                        \
+  static void test##name(long size) {                                          \
+    name r;                                                                    \
+    long v, slot = 0, pos = 0, batch[2 * size];                                \
+                                                                               \
+    CHECK(name##Init(&r, size));                                               \
+    CHECK(!name##TryPop(&r, &v, &slot));                                       \
+    for (long round = 0; round < 3 * size; round++) {                          \
+      for (long i = 0; i < size; i++) {                                        \
+        v = round * 1000 + i;                                                  \
+        CHECK(name##TryPush(&r, &v, &slot));                                   \
+        CHECK(slot == (pos + i) % size);                                       \
+      }                                                                        \
+      CHECK(!name##TryPush(&r, &v, &slot));                                    \
+      CHECK(name##Len(&r) == size);                                            \
+      for (long i = 0; i < size; i++) {                                        \
+        CHECK(name##TryPop(&r, &v, &slot));                                    \
+        CHECK(v == round * 1000 + i && slot == (pos + i) % size);              \
+      }                                                                        \
+      CHECK(!name##TryPop(&r, &v, &slot));                                     \
+      CHECK(name##Len(&r) == 0);                                               \
+      pos += size;                                                             \
+      CHECK(name##TryPush(&r, &v, &slot) && name##TryPop(&r, &v, &slot));      \
+      pos++;                                                                   \
+    }                                                                          \
+                                                                               \
+    for (long round = 0; round < 3 * size; round++) {                          \
+      for (long i = 0; i < 2 * size; i++)                                      \
+        batch[i] = round * 1000 + i;                                           \
+      CHECK(name##TryPushN(&r, batch, 2 * size, &slot) == size);               \
+      CHECK(slot == pos % size);                                               \
+      CHECK(name##TryPushN(&r, batch, 1, &slot) == 0);                         \
+      CHECK(name##TryPopN(&r, batch, 1, &slot) == 1);                          \
+      CHECK(batch[0] == round * 1000);                                         \
+      CHECK(name##TryPopN(&r, batch, 2 * size, &slot) == size - 1);            \
+      CHECK(slot == (pos + 1) % size);                                         \
+      for (long i = 0; i < size - 1; i++)                                      \
+        CHECK(batch[i] == round * 1000 + i + 1);                               \
+      CHECK(name##TryPopN(&r, batch, 1, &slot) == 0);                          \
+      pos += size;                                                             \
+      CHECK(name##TryPush(&r, &v, &slot) && name##TryPop(&r, &v, &slot));      \
+      pos++;                                                                   \
+    }                                                                          \
+                                                                               \
+    CHECK(name##Len(&r) == 0);                                                 \
+    name##Destroy(&r);                                                         \
+  }
+
+RING_TEST(lockedPow)
+RING_TEST(lockedOdd)
+RING_TEST(lockedAny)
+RING_TEST(spscPow)
+RING_TEST(spscOdd)
+RING_TEST(spscAny)
+RING_TEST(mpmcPow)
+RING_TEST(mpmcOdd)
+RING_TEST(mpmcAny)
+
+static mpmcAny mpmc;
+static spscOdd spsc;
+static atomic_long taken, sum;
+
+// Producer i pushes i * THREAD_ITEMS + 1 up to (i + 1) * THREAD_ITEMS
+static void *mpmcProducer(void *arg) {
+  long first = (long)arg * THREAD_ITEMS + 1, slot;
+  for (long v = first; v < first + THREAD_ITEMS; v++) {
+    while (!mpmcAnyTryPush(&mpmc, &v, &slot))
+      sched_yield();
+  }
+  return NULL;
+}
+
+static void *mpmcConsumer(void *arg) {
+  long v, slot;
+  while (atomic_load(&taken) < THREADS * THREAD_ITEMS) {
+    if (!mpmcAnyTryPop(&mpmc, &v, &slot)) {
+      sched_yield();
+      continue;
+    }
+    atomic_fetch_add(&taken, 1);
+    atomic_fetch_add(&sum, v);
+  }
+  return NULL;
+}
+
+static void testMpmcThreads() {
+  pthread_t pro[THREADS], con[THREADS];
+  long n = (long)THREADS * THREAD_ITEMS;
+
+  CHECK(mpmcAnyInit(&mpmc, 6));
+  atomic_store(&taken, 0);
+  atomic_store(&sum, 0);
+  for (long i = 0; i < THREADS; i++) {
+    pthread_create(&pro[i], NULL, mpmcProducer, (void *)i);
+    pthread_create(&con[i], NULL, mpmcConsumer, NULL);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(pro[i], NULL);
+    pthread_join(con[i], NULL);
+  }
+  CHECK(atomic_load(&taken) == n);
+  CHECK(atomic_load(&sum) == n * (n + 1) / 2);
+  CHECK(mpmcAnyLen(&mpmc) == 0);
+  mpmcAnyDestroy(&mpmc);
+}
+
+static void *spscProducer(void *arg) {
+  long slot;
+  for (long v = 0; v < THREAD_ITEMS; v++) {
+    while (!spscOddTryPush(&spsc, &v, &slot))
+      sched_yield();
+  }
+  return NULL;
+}
+
+// The one consumer sees every item, in order
+static void testSpscThreads() {
+  pthread_t pro;
+  long v, slot, next = 0;
+  bool ordered = true;
+
+  CHECK(spscOddInit(&spsc, 0));
+  pthread_create(&pro, NULL, spscProducer, NULL);
+  while (next < THREAD_ITEMS) {
+    if (!spscOddTryPop(&spsc, &v, &slot)) {
+      sched_yield();
+      continue;
+    }
+    ordered &= v == next++;
+  }
+  pthread_join(pro, NULL);
+  CHECK(ordered);
+  spscOddDestroy(&spsc);
+}
+
+int main() {
+  testlockedPow(8);
+  testlockedOdd(6);
+  testlockedAny(8);
+  testlockedAny(6);
+  testspscPow(8);
+  testspscOdd(6);
+  testspscAny(8);
+  testspscAny(6);
+  testmpmcPow(8);
+  testmpmcOdd(6);
+  testmpmcAny(8);
+  testmpmcAny(6);
+  testMpmcThreads();
+  testSpscThreads();
+
+  printf("ring: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,359 @@
+/*
+ * Offline analysis of the client logs, the native version of the delay plots
+ * of report/plots.ipynb.
+ *
+ * For every symbol it streams logs_<symbol>.csv and
+ * logs_<symbol>_candlestick.csv in parallel chunks and writes:
+ *  - summary.csv                   one row per symbol
+ *  - delay_hist_<symbol>.csv       delay_ms,count of the non empty 1 ms bins
+ *  - trade_rate_<symbol>.csv       trades per minute of trade timestamp
+ *  - candle_jitter_<symbol>.csv    interval between candlesticks and its
+ *                                  deviation from a minute
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "csvscan.h"
+#include "findata.h"
+
+// Delays of a minute or more share the last bin; their maximum is kept apart
+#define MAX_DELAY_MS 60000
+
+typedef struct {
+  uint64_t minute;
+  uint64_t trades;
+} minuteCount;
+
+// Transaction log statistics of one chunk
+typedef struct {
+  uint64_t *delayHist;
+  uint64_t trades;
+  uint64_t negative; // delays below 0 from clock skew, counted in bin 0
+  int64_t maxDelay;
+  double delaySum;
+  minuteCount *rate;
+  long rateLen, rateCap;
+  bool failed; // an allocation failed, the statistics are incomplete
+} txStats;
+
+// Candlestick timestamps of one chunk. The intervals are taken after the
+// chunks are joined, so the one across a chunk boundary is not lost.
+typedef struct {
+  uint64_t *timestamps;
+  long len, cap;
+  bool failed;
+} candleStats;
+
+static const char *logDir = ".";
+static const char *outDir = ".";
+
+// Returns false if the rate can not grow
+static bool rateAdd(txStats *s, uint64_t minute) {
+  long i = s->rateLen;
+  while (i > 0 && s->rate[i - 1].minute > minute)
+    i--;
+  if (i > 0 && s->rate[i - 1].minute == minute) {
+    s->rate[i - 1].trades++;
+    return true;
+  }
+  if (s->rateLen == s->rateCap) {
+    long cap = s->rateCap ? 2 * s->rateCap : 64;
+    minuteCount *rate =
+        (minuteCount *)realloc(s->rate, cap * sizeof(minuteCount));
+    if (rate == NULL)
+      return false;
+    s->rate = rate;
+    s->rateCap = cap;
+  }
+  memmove(&s->rate[i + 1], &s->rate[i],
+          (s->rateLen - i) * sizeof(minuteCount));
+  s->rateLen++;
+  s->rate[i] = (minuteCount){minute, 1};
+  return true;
+}
+
+static void scanTransactions(const char *begin, const char *end, int chunk,
+                             void *arg) {
+  txStats *s = &((txStats *)arg)[chunk];
+  const char *p = begin, *line, *lineEnd;
+  const char *f[5];
+
+  s->delayHist = (uint64_t *)calloc(MAX_DELAY_MS + 1, sizeof(uint64_t));
+  if (s->delayHist == NULL) {
+    s->failed = true;
+    return;
+  }
+  while ((line = csvNextLine(&p, end, &lineEnd)) != NULL) {
+    if (line == lineEnd || (unsigned char)(*line - '0') > 9)
+      continue;
+    if (csvFields(line, lineEnd, f, 5) < 5)
+      continue;
+    uint64_t ts = uintFromString(f[2]);
+    int64_t delay = (int64_t)uintFromString(f[4]) - (int64_t)ts;
+
+    if (delay < 0) {
+      s->negative++;
+      delay = 0;
+    }
+    if (delay > s->maxDelay)
+      s->maxDelay = delay;
+    s->delayHist[delay < MAX_DELAY_MS ? delay : MAX_DELAY_MS]++;
+    s->delaySum += delay;
+    s->trades++;
+    if (!rateAdd(s, ts / 60000)) {
+      s->failed = true;
+      return;
+    }
+  }
+}
+
+static void scanCandlesticks(const char *begin, const char *end, int chunk,
+                             void *arg) {
+  candleStats *s = &((candleStats *)arg)[chunk];
+  const char *p = begin, *line, *lineEnd;
+  const char *f[9];
+
+  while ((line = csvNextLine(&p, end, &lineEnd)) != NULL) {
+    if (line == lineEnd || (unsigned char)(*line - '0') > 9)
+      continue;
+    if (csvFields(line, lineEnd, f, 9) < 9)
+      continue;
+    if (s->len == s->cap) {
+      long cap = s->cap ? 2 * s->cap : 256;
+      uint64_t *timestamps =
+          (uint64_t *)realloc(s->timestamps, cap * sizeof(uint64_t));
+      if (timestamps == NULL) {
+        s->failed = true;
+        return;
+      }
+      s->timestamps = timestamps;
+      s->cap = cap;
+    }
+    s->timestamps[s->len++] = uintFromString(f[8]);
+  }
+}
+
+static int64_t histPercentile(uint64_t *hist, uint64_t n, double p,
+                              int64_t maxDelay) {
+  uint64_t rank = (uint64_t)ceil(p * n);
+  uint64_t seen = 0;
+  for (int i = 0; i <= MAX_DELAY_MS; i++) {
+    seen += hist[i];
+    if (seen >= rank && seen > 0)
+      return i < MAX_DELAY_MS ? i : maxDelay;
+  }
+  return maxDelay;
+}
+
+static int cmpInt64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static FILE *openOut(const char *name, const char *logName) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s%s%s.csv", outDir, name,
+           logName ? "_" : "", logName ? logName : "");
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    perror(path);
+    exit(1);
+  }
+  return fp;
+}
+
+static void analyzeTransactions(symbol *sym, int threads, FILE *summary) {
+  char path[512];
+  csvFile f;
+  snprintf(path, sizeof(path), "%s/logs_%s.csv", logDir, sym->logName);
+
+  txStats *chunks = (txStats *)calloc(threads, sizeof(txStats));
+  txStats all = {(uint64_t *)calloc(MAX_DELAY_MS + 1, sizeof(uint64_t))};
+  bool failed = chunks == NULL || all.delayHist == NULL;
+  int n = 0;
+  if (!failed && csvOpen(&f, path) == 0) {
+    n = csvScan(&f, threads, scanTransactions, chunks);
+    csvClose(&f);
+  } else if (!failed) {
+    fprintf(stderr, "analyze: no %s\n", path);
+  }
+  for (int c = 0; c < n; c++)
+    failed = failed || chunks[c].failed;
+  if (failed) {
+    fprintf(stderr, "analyze: out of memory for %s\n", path);
+    for (int c = 0; c < n; c++) {
+      free(chunks[c].delayHist);
+      free(chunks[c].rate);
+    }
+    fprintf(summary, "%s,0,0,0.000,0,0,0,0,0", sym->name);
+    free(all.delayHist);
+    free(chunks);
+    return;
+  }
+
+  // Fold the chunks together
+  FILE *rate = openOut("trade_rate", sym->logName);
+  fprintf(rate, "Timestamp,Trades\n");
+  uint64_t lastMinute = 0, lastCount = 0;
+  for (int c = 0; c < n; c++) {
+    txStats *s = &chunks[c];
+    for (int i = 0; i <= MAX_DELAY_MS; i++)
+      all.delayHist[i] += s->delayHist[i];
+    all.trades += s->trades;
+    all.negative += s->negative;
+    all.delaySum += s->delaySum;
+    if (s->maxDelay > all.maxDelay)
+      all.maxDelay = s->maxDelay;
+    // Chunks are in file order, so only a boundary minute can repeat
+    for (long i = 0; i < s->rateLen; i++) {
+      if (lastCount && s->rate[i].minute == lastMinute) {
+        lastCount += s->rate[i].trades;
+        continue;
+      }
+      if (lastCount)
+        fprintf(rate, "%" PRIu64 ",%" PRIu64 "\n", lastMinute * 60000,
+                lastCount);
+      lastMinute = s->rate[i].minute;
+      lastCount = s->rate[i].trades;
+    }
+    free(s->delayHist);
+    free(s->rate);
+  }
+  if (lastCount)
+    fprintf(rate, "%" PRIu64 ",%" PRIu64 "\n", lastMinute * 60000, lastCount);
+  fclose(rate);
+
+  FILE *hist = openOut("delay_hist", sym->logName);
+  fprintf(hist, "DelayMs,Count\n");
+  for (int i = 0; i <= MAX_DELAY_MS; i++) {
+    if (all.delayHist[i])
+      fprintf(hist, "%d,%" PRIu64 "\n", i, all.delayHist[i]);
+  }
+  fclose(hist);
+
+  fprintf(summary, "%s,%" PRIu64 ",%" PRIu64 ",%.3f", sym->name, all.trades,
+          all.negative, all.trades ? all.delaySum / all.trades : 0.0);
+  double ps[] = {0.5, 0.9, 0.99, 0.999};
+  for (int i = 0; i < 4; i++)
+    fprintf(summary, ",%" PRId64,
+            histPercentile(all.delayHist, all.trades, ps[i], all.maxDelay));
+  fprintf(summary, ",%" PRId64, all.maxDelay);
+
+  free(all.delayHist);
+  free(chunks);
+}
+
+static void analyzeCandlesticks(symbol *sym, int threads, FILE *summary) {
+  char path[512];
+  csvFile f;
+  snprintf(path, sizeof(path), "%s/logs_%s_candlestick.csv", logDir,
+           sym->logName);
+
+  candleStats *chunks = (candleStats *)calloc(threads, sizeof(candleStats));
+  bool failed = chunks == NULL;
+  int n = 0;
+  if (!failed && csvOpen(&f, path) == 0) {
+    n = csvScan(&f, threads, scanCandlesticks, chunks);
+    csvClose(&f);
+  } else if (!failed) {
+    fprintf(stderr, "analyze: no %s\n", path);
+  }
+
+  long total = 0;
+  for (int c = 0; c < n; c++) {
+    total += chunks[c].len;
+    failed = failed || chunks[c].failed;
+  }
+  int64_t *jitter = failed ? NULL
+                           : (int64_t *)malloc((total > 0 ? total : 1) *
+                                               sizeof(int64_t));
+  if (jitter == NULL) {
+    fprintf(stderr, "analyze: out of memory for %s\n", path);
+    for (int c = 0; c < n; c++)
+      free(chunks[c].timestamps);
+    fprintf(summary, ",0,0.000,0.000,0,0,0\n");
+    free(chunks);
+    return;
+  }
+  long numJitter = 0;
+  double sum = 0, sumSq = 0;
+
+  FILE *out = openOut("candle_jitter", sym->logName);
+  fprintf(out, "Timestamp,IntervalMs,JitterMs\n");
+  uint64_t prev = 0;
+  for (int c = 0; c < n; c++) {
+    for (long i = 0; i < chunks[c].len; i++) {
+      uint64_t ts = chunks[c].timestamps[i];
+      if (prev) {
+        int64_t interval = (int64_t)(ts - prev);
+        int64_t j = interval - 60000;
+        fprintf(out, "%" PRIu64 ",%" PRId64 ",%" PRId64 "\n", ts, interval, j);
+        jitter[numJitter++] = j;
+        sum += j;
+        sumSq += (double)j * j;
+      }
+      prev = ts;
+    }
+    free(chunks[c].timestamps);
+  }
+  fclose(out);
+
+  qsort(jitter, numJitter, sizeof(int64_t), cmpInt64);
+  double mean = numJitter ? sum / numJitter : 0;
+  double std = numJitter ? sqrt(sumSq / numJitter - mean * mean) : 0;
+  fprintf(summary, ",%ld,%.3f,%.3f", total, mean, std);
+  if (numJitter)
+    fprintf(summary, ",%" PRId64 ",%" PRId64 ",%" PRId64 "\n", jitter[0],
+            jitter[(long)(0.99 * (numJitter - 1))], jitter[numJitter - 1]);
+  else
+    fprintf(summary, ",0,0,0\n");
+
+  free(jitter);
+  free(chunks);
+}
+
+static void usage() {
+  printf(
+      "USAGE: ./bin/analyze [-t threads] [-d <log dir>] [-o <output dir>]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while ((opt = getopt(argc, argv, "t:d:o:")) != -1) {
+    switch (opt) {
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'd':
+      logDir = optarg;
+      break;
+    case 'o':
+      outDir = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (threads < 1)
+    threads = 1;
+  mkdir(outDir, 0755);
+
+  FILE *summary = openOut("summary", NULL);
+  fprintf(summary, "Symbol,Trades,NegativeDelays,DelayMeanMs,DelayP50Ms,"
+                   "DelayP90Ms,DelayP99Ms,DelayP999Ms,DelayMaxMs,Candlesticks,"
+                   "JitterMeanMs,JitterStdMs,JitterMinMs,JitterP99Ms,"
+                   "JitterMaxMs\n");
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    analyzeTransactions(&symbols[i], threads, summary);
+    analyzeCandlesticks(&symbols[i], threads, summary);
+  }
+  fclose(summary);
+  return 0;
+}
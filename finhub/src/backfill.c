@@ -0,0 +1,178 @@
+#include "backfill.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csvscan.h"
+#include "findata.h"
+#include "metrics.h"
+
+// backfillSymbol ran out of memory
+#define BACKFILL_NOMEM -2
+
+typedef struct {
+  uint64_t minute;
+  candlestickMinute c;
+} minuteCandle;
+
+// The candlesticks of one chunk, sorted by minute
+typedef struct {
+  minuteCandle *buf;
+  long len, cap;
+  long trades;
+  bool failed; // an allocation failed, the history is incomplete
+} candleHistory;
+
+// Logs are written in order, so the minute is nearly always the last one or a
+// new one at the end. Returns NULL if the history can not grow.
+static candlestickMinute *historyAt(candleHistory *h, uint64_t minute) {
+  long i = h->len;
+  while (i > 0 && h->buf[i - 1].minute > minute)
+    i--;
+  if (i > 0 && h->buf[i - 1].minute == minute)
+    return &h->buf[i - 1].c;
+
+  if (h->len == h->cap) {
+    long cap = h->cap ? 2 * h->cap : 64;
+    minuteCandle *buf =
+        (minuteCandle *)realloc(h->buf, cap * sizeof(minuteCandle));
+    if (buf == NULL)
+      return (NULL);
+    h->buf = buf;
+    h->cap = cap;
+  }
+  memmove(&h->buf[i + 1], &h->buf[i], (h->len - i) * sizeof(minuteCandle));
+  h->len++;
+  h->buf[i].minute = minute;
+  candlestickInit(&h->buf[i].c);
+  return &h->buf[i].c;
+}
+
+static void aggregateChunk(const char *begin, const char *end, int chunk,
+                           void *arg) {
+  candleHistory *h = &((candleHistory *)arg)[chunk];
+  const char *p = begin, *line, *lineEnd;
+  const char *f[5];
+  findata t;
+
+  while ((line = csvNextLine(&p, end, &lineEnd)) != NULL) {
+    // Skips the header and the empty line the client writes every minute
+    if (line == lineEnd || (unsigned char)(*line - '0') > 9)
+      continue;
+    if (csvFields(line, lineEnd, f, 5) < 4)
+      continue;
+    t.price = (char *)f[0];
+    t.symbol = (char *)f[1];
+    t.timestamp = (char *)f[2];
+    t.volume = (char *)f[3];
+    uint64_t minute = uintFromString(t.timestamp) / 60000;
+    candlestickMinute *c = historyAt(h, minute);
+    if (c == NULL) {
+      h->failed = true;
+      return;
+    }
+    if (updateCandlestick(c, &t))
+      h->trades++;
+  }
+}
+
+// Merges the later history b into a. Returns false, leaving a as it was, if
+// there is no memory for the merged one.
+static bool historyMerge(candleHistory *a, candleHistory *b) {
+  candleHistory out = {NULL, 0, 0, a->trades + b->trades, false};
+  out.cap = a->len + b->len;
+  out.buf = (minuteCandle *)malloc((out.cap ? out.cap : 1) *
+                                   sizeof(minuteCandle));
+  if (out.buf == NULL)
+    return false;
+
+  long i = 0, j = 0;
+  while (i < a->len || j < b->len) {
+    if (j == b->len || (i < a->len && a->buf[i].minute < b->buf[j].minute)) {
+      out.buf[out.len++] = a->buf[i++];
+    } else if (i == a->len || b->buf[j].minute < a->buf[i].minute) {
+      out.buf[out.len++] = b->buf[j++];
+    } else {
+      out.buf[out.len] = a->buf[i++];
+      candlestickMerge(&out.buf[out.len++].c, &b->buf[j++].c);
+    }
+  }
+
+  free(a->buf);
+  *a = out;
+  return true;
+}
+
+static void historyFree(candleHistory *h, int chunks) {
+  for (int i = 0; i < chunks; i++)
+    free(h[i].buf);
+  free(h);
+}
+
+// Returns the number of trades loaded, -1 if there is no log and
+// BACKFILL_NOMEM if an allocation failed
+static long backfillSymbol(symbol *s, int threads, uint64_t nowMinute) {
+  char path[64];
+  csvFile f;
+
+  sprintf(path, "logs_%s.csv", s->logName);
+  if (csvOpen(&f, path))
+    return -1;
+
+  candleHistory *h = (candleHistory *)calloc(threads, sizeof(candleHistory));
+  if (h == NULL) {
+    csvClose(&f);
+    return BACKFILL_NOMEM;
+  }
+  int chunks = csvScan(&f, threads, aggregateChunk, h);
+  csvClose(&f);
+  for (int i = 0; i < chunks; i++) {
+    if (h[i].failed || (i > 0 && !historyMerge(&h[0], &h[i]))) {
+      historyFree(h, threads);
+      return BACKFILL_NOMEM;
+    }
+  }
+
+  // Completed minutes feed the moving average, the current one keeps running
+  uint64_t last = 0;
+  for (long i = 0; i < h[0].len; i++) {
+    minuteCandle *m = &h[0].buf[i];
+    if (m->minute < nowMinute) {
+      addDataPoint(&s->ma, getMean(&m->c));
+      last = m->minute;
+    } else if (m->minute == nowMinute) {
+      s->c = m->c;
+    }
+  }
+  if (last + MOVING_AVERAGE_TIMESPAN_MINUTES < nowMinute)
+    movingAverageInit(&s->ma);
+
+  long trades = h[0].trades;
+  historyFree(h, threads);
+  return trades;
+}
+
+long backfill(int threads, uint64_t now) {
+  long total = -1;
+  uint64_t start = monotonicNs();
+
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    long trades = backfillSymbol(&symbols[i], threads, now / 60000);
+    if (trades == BACKFILL_NOMEM) {
+      fprintf(stderr, "[Backfill] out of memory, starting cold\n");
+      for (int j = 0; j < NUM_SYMBOLS; j++) {
+        candlestickInit(&symbols[j].c);
+        movingAverageInit(&symbols[j].ma);
+      }
+      return -1;
+    }
+    if (trades >= 0)
+      total = (total < 0 ? 0 : total) + trades;
+  }
+
+  if (total >= 0)
+    printf("[Backfill] %ld trades in %.1f ms\n", total,
+           (monotonicNs() - start) / 1e6);
+  return total;
+}
@@ -0,0 +1,15 @@
+#ifndef BACKFILL_H
+#define BACKFILL_H
+
+#include <stdint.h>
+
+// Rebuilds the candlestick of the running minute and the moving average window
+// of every symbol from the transaction logs (logs_<symbol>.csv) of previous
+// runs. Each log is scanned by `threads` threads. Trades are bucketed by the
+// minute of their trade timestamp and go through updateCandlestick and
+// addDataPoint like live ones. Returns the number of trades loaded, or -1 if
+// there was no log to load or an allocation failed. On failure no symbol is
+// left partly restored.
+long backfill(int threads, uint64_t now);
+
+#endif
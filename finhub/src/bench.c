@@ -0,0 +1,390 @@
+/*
+ * Micro-benchmarks for the hot path of the finhub client.
+ *
+ * Every component is run for a fixed number of timed samples after a warm-up,
+ * pinned on one cpu. A sample times a batch of operations, so the cost of
+ * reading the clock is amortized, and the report gives ns/op statistics over
+ * all the samples of a configuration.
+ */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "findata.h"
+
+#define MAX_SWEEP 16
+#define POOL_SIZE 1024
+
+typedef struct {
+  long iterations;
+  long warmup;
+  int cpu;
+  int json;
+  long symbols[MAX_SWEEP];
+  int numSymbols;
+  long queueSizes[MAX_SWEEP];
+  int numQueueSizes;
+  long batches[MAX_SWEEP];
+  int numBatches;
+} benchConfig;
+
+// The parameters of one run. A value of 0 means the component does not depend
+// on that parameter.
+typedef struct {
+  long symbols;
+  long queueSize;
+  long batch;
+} benchParams;
+
+typedef struct {
+  const char *name;
+  bool usesSymbols;
+  bool usesQueue;
+  // Runs one sample and returns the number of operations it timed
+  long (*run)(benchParams *p, long sample, uint64_t *ns);
+} component;
+
+// Synthetic trades, spread round robin over the first `symbols` symbols
+static char poolPrice[POOL_SIZE][32];
+static char poolTimestamp[POOL_SIZE][32];
+static char poolVolume[POOL_SIZE][32];
+static findata pool[POOL_SIZE];
+static fixed_t poolMean[POOL_SIZE];
+
+static queue *q;
+static volatile fixed_t sink;
+static findata *scratch;
+
+static uint64_t now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void poolInit(long numSymbols) {
+  for (int i = 0; i < POOL_SIZE; i++) {
+    sprintf(poolPrice[i], "%.4f", 100.0 + (i % 97) * 0.0137);
+    sprintf(poolTimestamp[i], "%llu", 1719343990450ULL + i * 37);
+    sprintf(poolVolume[i], "%d", 1 + i % 300);
+    pool[i].price = poolPrice[i];
+    pool[i].symbol = (char *)symbols[i % numSymbols].name;
+    pool[i].timestamp = poolTimestamp[i];
+    pool[i].volume = poolVolume[i];
+    poolMean[i] = (100 * FIXED_SCALE) + (i % 89) * 2100000;
+  }
+}
+
+static long runFindataFromJson(benchParams *p, long sample, uint64_t *ns) {
+  findata *t = scratch;
+  uint64_t start = now();
+  for (long i = 0; i < p->batch; i++) {
+    findata *in = &pool[(sample + i) % POOL_SIZE];
+    findataFromJson(&t[i], tok[0], in->price);
+    findataFromJson(&t[i], tok[1], in->symbol);
+    findataFromJson(&t[i], tok[2], in->timestamp);
+    findataFromJson(&t[i], tok[3], in->volume);
+  }
+  *ns = now() - start;
+  for (long i = 0; i < p->batch; i++) {
+    findataFree(&t[i]);
+  }
+  return p->batch;
+}
+
+static long runFixedFromString(benchParams *p, long sample, uint64_t *ns) {
+  fixed_t sum = 0, x;
+  uint64_t start = now();
+  for (long i = 0; i < p->batch; i++) {
+    if (fixedFromString(pool[(sample + i) % POOL_SIZE].price, &x))
+      sum += x;
+  }
+  *ns = now() - start;
+  sink += sum;
+  return p->batch;
+}
+
+static void queueReset(queue *q) {
+  findataRingClear(&q->ring);
+  q->spillHead = q->spillLen = 0;
+}
+
+static long runQueueAdd(benchParams *p, long sample, uint64_t *ns) {
+  long n = p->batch < q->size ? p->batch : q->size;
+  queueReset(q);
+  uint64_t start = now();
+  for (long i = 0; i < n; i++) {
+    queueAdd(q, &pool[(sample + i) % POOL_SIZE]);
+  }
+  *ns = now() - start;
+  return n;
+}
+
+// Includes saveTransaction, since queueDel consumes the item it removes
+static long runQueueDel(benchParams *p, long sample, uint64_t *ns) {
+  long n = p->batch < q->size ? p->batch : q->size;
+  queueReset(q);
+  for (long i = 0; i < n; i++) {
+    queueAdd(q, &pool[(sample + i) % POOL_SIZE]);
+  }
+  uint64_t start = now();
+  for (long i = 0; i < n; i++) {
+    queueDel(q);
+  }
+  *ns = now() - start;
+  return n;
+}
+
+static long runSaveTransaction(benchParams *p, long sample, uint64_t *ns) {
+  uint64_t start = now();
+  for (long i = 0; i < p->batch; i++) {
+    saveTransaction(&pool[(sample + i) % POOL_SIZE]);
+  }
+  *ns = now() - start;
+  return p->batch;
+}
+
+static long runUpdateCandlestick(benchParams *p, long sample, uint64_t *ns) {
+  uint64_t start = now();
+  for (long i = 0; i < p->batch; i++) {
+    findata *t = &pool[(sample + i) % POOL_SIZE];
+    updateCandlestick(&symbols[i % p->symbols].c, t);
+  }
+  *ns = now() - start;
+  return p->batch;
+}
+
+static long runAddDataPoint(benchParams *p, long sample, uint64_t *ns) {
+  movingAverage *ma = &symbols[0].ma;
+  uint64_t start = now();
+  for (long i = 0; i < p->batch; i++) {
+    addDataPoint(ma, poolMean[(sample + i) % POOL_SIZE]);
+  }
+  *ns = now() - start;
+  return p->batch;
+}
+
+static long runSaveCandlestick(benchParams *p, long sample, uint64_t *ns) {
+  symbol *s = &symbols[0];
+  uint64_t start = now();
+  for (long i = 0; i < p->batch; i++) {
+    saveCandlestick(&s->c, s->fp_candlestick, get_timestamp());
+  }
+  *ns = now() - start;
+  return p->batch;
+}
+
+static component components[] = {
+    {"findataFromJson", true, false, runFindataFromJson},
+    {"fixedFromString", false, false, runFixedFromString},
+    {"queueAdd", false, true, runQueueAdd},
+    {"queueDel", true, true, runQueueDel},
+    {"saveTransaction", true, false, runSaveTransaction},
+    {"updateCandlestick", true, false, runUpdateCandlestick},
+    {"addDataPoint", false, false, runAddDataPoint},
+    {"saveCandlestick", false, false, runSaveCandlestick},
+};
+
+static int cmpDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, long n, double p) {
+  long i = (long)(p * (n - 1) + 0.5);
+  return sorted[i];
+}
+
+static void report(benchConfig *cfg, component *c, benchParams *p,
+                   double *nsPerOp, bool first) {
+  long n = cfg->iterations;
+  double sum = 0;
+  for (long i = 0; i < n; i++) {
+    sum += nsPerOp[i];
+  }
+  qsort(nsPerOp, n, sizeof(double), cmpDouble);
+
+  const char *fmt = cfg->json
+                        ? "%s{\"component\":\"%s\",\"symbols\":%ld,"
+                          "\"queue_size\":%ld,\"batch\":%ld,\"samples\":%ld,"
+                          "\"mean_ns\":%.2f,\"min_ns\":%.2f,\"p50_ns\":%.2f,"
+                          "\"p90_ns\":%.2f,\"p99_ns\":%.2f,\"max_ns\":%.2f}"
+                        : "%s%s,%ld,%ld,%ld,%ld,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n";
+  printf(fmt, cfg->json && !first ? ",\n" : "", c->name, p->symbols,
+         p->queueSize, p->batch, n, sum / n, nsPerOp[0],
+         percentile(nsPerOp, n, 0.50), percentile(nsPerOp, n, 0.90),
+         percentile(nsPerOp, n, 0.99), nsPerOp[n - 1]);
+}
+
+static void benchmark(benchConfig *cfg, component *c, benchParams *p,
+                      double *nsPerOp, bool first) {
+  uint64_t ns;
+  long ops;
+
+  poolInit(p->symbols ? p->symbols : NUM_SYMBOLS);
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    candlestickInit(&symbols[i].c);
+    movingAverageInit(&symbols[i].ma);
+  }
+  q = queueInit(p->queueSize ? p->queueSize : 1);
+
+  for (long i = 0; i < cfg->warmup; i++) {
+    c->run(p, i, &ns);
+  }
+  for (long i = 0; i < cfg->iterations; i++) {
+    ops = c->run(p, i, &ns);
+    nsPerOp[i] = (double)ns / ops;
+  }
+
+  queueDelete(q);
+  report(cfg, c, p, nsPerOp, first);
+}
+
+static int parseList(const char *arg, long *out) {
+  int n = 0;
+  char *end;
+  while (*arg && n < MAX_SWEEP) {
+    out[n] = strtol(arg, &end, 10);
+    if (end == arg || out[n] <= 0)
+      return -1;
+    n++;
+    arg = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static void usage() {
+  printf("USAGE: ./bin/bench [-n samples] [-w warmup samples] [-c cpu|-1] "
+         "[-s symbols,..] [-q queue sizes,..] [-b batch sizes,..] "
+         "[-f csv|json]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  benchConfig cfg = {.iterations = 10000,
+                     .warmup = 1000,
+                     .cpu = 0,
+                     .json = 0,
+                     .symbols = {NUM_SYMBOLS},
+                     .numSymbols = 1,
+                     .queueSizes = {100},
+                     .numQueueSizes = 1,
+                     .batches = {16},
+                     .numBatches = 1};
+  int opt;
+  while ((opt = getopt(argc, argv, "n:w:c:s:q:b:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      cfg.iterations = atol(optarg);
+      break;
+    case 'w':
+      cfg.warmup = atol(optarg);
+      break;
+    case 'c':
+      cfg.cpu = atoi(optarg);
+      break;
+    case 's':
+      cfg.numSymbols = parseList(optarg, cfg.symbols);
+      break;
+    case 'q':
+      cfg.numQueueSizes = parseList(optarg, cfg.queueSizes);
+      break;
+    case 'b':
+      cfg.numBatches = parseList(optarg, cfg.batches);
+      break;
+    case 'f':
+      if (strcmp(optarg, "json") == 0)
+        cfg.json = 1;
+      else if (strcmp(optarg, "csv") == 0)
+        cfg.json = 0;
+      else
+        usage();
+      break;
+    default:
+      usage();
+    }
+  }
+  if (cfg.iterations <= 0 || cfg.warmup < 0 || cfg.numSymbols <= 0 ||
+      cfg.numQueueSizes <= 0 || cfg.numBatches <= 0)
+    usage();
+  for (int i = 0; i < cfg.numSymbols; i++) {
+    if (cfg.symbols[i] > NUM_SYMBOLS) {
+      fprintf(stderr, "bench: at most %d symbols.\n", NUM_SYMBOLS);
+      exit(1);
+    }
+  }
+
+  if (cfg.cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cfg.cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+      fprintf(stderr, "bench: could not pin to cpu %d.\n", cfg.cpu);
+      exit(1);
+    }
+  }
+
+  // The csv writers of the client go to /dev/null, so only the formatting and
+  // the stdio buffering are measured
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    symbols[i].transaction = fopen("/dev/null", "w");
+    symbols[i].fp_candlestick = fopen("/dev/null", "w");
+    symbols[i].fp_ma = fopen("/dev/null", "w");
+  }
+
+  long maxBatch = 0;
+  for (int i = 0; i < cfg.numBatches; i++) {
+    if (cfg.batches[i] > maxBatch)
+      maxBatch = cfg.batches[i];
+  }
+  scratch = (findata *)malloc(maxBatch * sizeof(findata));
+  double *nsPerOp = (double *)malloc(cfg.iterations * sizeof(double));
+  if (scratch == NULL || nsPerOp == NULL) {
+    fprintf(stderr, "bench: out of memory.\n");
+    exit(1);
+  }
+
+  if (cfg.json)
+    printf("[\n");
+  else
+    printf("component,symbols,queue_size,batch,samples,mean_ns,min_ns,p50_ns,"
+           "p90_ns,p99_ns,max_ns\n");
+
+  bool first = true;
+  int numComponents = sizeof(components) / sizeof(components[0]);
+  for (int c = 0; c < numComponents; c++) {
+    component *comp = &components[c];
+    int ns = comp->usesSymbols ? cfg.numSymbols : 1;
+    int nq = comp->usesQueue ? cfg.numQueueSizes : 1;
+    for (int s = 0; s < ns; s++) {
+      for (int qs = 0; qs < nq; qs++) {
+        for (int b = 0; b < cfg.numBatches; b++) {
+          benchParams p = {
+              .symbols = comp->usesSymbols ? cfg.symbols[s] : 0,
+              .queueSize = comp->usesQueue ? cfg.queueSizes[qs] : 0,
+              .batch = cfg.batches[b],
+          };
+          benchmark(&cfg, comp, &p, nsPerOp, first);
+          first = false;
+        }
+      }
+    }
+  }
+
+  if (cfg.json)
+    printf("\n]\n");
+
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    fclose(symbols[i].transaction);
+    fclose(symbols[i].fp_candlestick);
+    fclose(symbols[i].fp_ma);
+  }
+  free(scratch);
+  free(nsPerOp);
+  return 0;
+}
@@ -7,6 +7,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "backfill.h"
+#include "findata.h"
+#include "metrics.h"
+#include "pool.h"
+#include "snapshot.h"
+
 // Define colors for printing
 #define KGRN "\033[0;32;32m"
 #define KCYN "\033[0;36m"
@@ -19,79 +25,8 @@
 
 #define QUEUESIZE 100
 #define NUM_PRO_THREADS 2
-#define NUM_CON_THREADS 2
 
-#define MOVING_AVERAGE_TIMESPAN_MINUTES 15
-
-typedef struct {
-  char *price;
-  char *symbol;
-  char *timestamp;
-  char *volume;
-} findata;
-
-const findata DEFAULT_FINDATA = {"-1", "-1", "-1", "-1"};
-
-typedef struct {
-  findata buf[QUEUESIZE];
-  long head, tail;
-  int full, empty;
-  pthread_cond_t *notFull, *notEmpty;
-} queue;
-
-typedef struct {
-  double open;
-  double close;
-  double max;
-  double min;
-  double vol;
-  double totalPrice;
-  uint64_t numTransactions;
-  bool isDefault;
-} candlestickMinute;
-
-typedef struct {
-  double prices[MOVING_AVERAGE_TIMESPAN_MINUTES];
-  double totalPrice;
-  uint8_t count;
-  uint8_t index;
-} movingAverage;
-
-// todo: use this struct
-typedef struct {
-  candlestickMinute c;
-  movingAverage ma;
-  FILE *transaction;
-  FILE *fp_ma;
-  FILE *fp_candlestick;
-} symbol;
-
-movingAverage amzn_ma;
-movingAverage msft_ma;
-movingAverage binance_ma;
-movingAverage icm_ma;
-
-static FILE *amzn_fp;
-static FILE *msft_fp;
-static FILE *binance_fp;
-static FILE *icm_fp;
-
-static FILE *amzn_fp_candlestick;
-static FILE *msft_fp_candlestick;
-static FILE *binance_fp_candlestick;
-static FILE *icm_fp_candlestick;
-
-static FILE *amzn_fp_ma;
-static FILE *msft_fp_ma;
-static FILE *binance_fp_ma;
-static FILE *icm_fp_ma;
-
-queue *fifo;
-
-candlestickMinute *amzn_candlestick;
-candlestickMinute *msft_candlestick;
-candlestickMinute *binance_candlestick;
-candlestickMinute *icm_candlestick;
+#define METRICS_PORT 9464
 
 typedef struct {
   findata temp;
@@ -99,40 +34,35 @@ typedef struct {
 } pthread_data;
 
 pthread_t producers[NUM_PRO_THREADS];
-pthread_t consumers[NUM_CON_THREADS];
+pthread_t consumers[POOL_MAX_CONSUMERS];
 pthread_t scheduler;
+pthread_t snapshotter;
+pthread_t poolSizer;
+
+queue *fifo;
 
 pthread_mutex_t *mux;
 
 pthread_data prodData[NUM_PRO_THREADS];
-pthread_data conData[NUM_CON_THREADS];
+pthread_data conData[POOL_MAX_CONSUMERS];
 
 bool areProducersFinished = false; // false if there are producers else true
 bool *isConsumerFinished;          // keep track if consumer finished its tasks
 
 uint64_t minutesSinceStart = 0;
+uint64_t candleStart; // ms since epoch when the running minute started
+
+static const char *snapshotPath = SNAPSHOT_PATH;
+static int snapshotInterval = SNAPSHOT_INTERVAL_SECONDS;
+static int backfillThreads = 0;
+static int minConsumers = POOL_MIN_DEFAULT;
+static int maxConsumers = POOL_MAX_DEFAULT;
 
 void *producer(void *args);
 void *consumer(void *args);
-
-queue *queueInit();
-void queueDelete(queue *q);
-void queueAdd(queue *q, findata *in);
-void queueDel(queue *q);
-
-candlestickMinute *candlestickInit();
-void movingAverageInit(movingAverage *ma);
-void saveCandlestick(candlestickMinute *c, FILE *fp);
-double getMean(candlestickMinute *c);
-void updateCandlestick(candlestickMinute *c, findata *transaction);
-void saveTransaction(findata *transaction);
-void saveMovingAverage(movingAverage *ma, FILE *fp);
 void *schedule(void *args);
-void addDataPoint(movingAverage *ma, double price);
+void *snapshotLoop(void *args);
 bool areConsumersFinished();
-void transactionsHeader(FILE *fp);
-void candlesticksHeader(FILE *fp);
-void movingAverageHeader(FILE *fp);
 
 // Variable that is =1 if the client should keep running, and =0 to close the
 // client
@@ -145,46 +75,12 @@ static int connection_flag = 0;
 // otherwise
 static int writeable_flag = 0;
 
+// Trades the callback queued during the running lws_service, under mux
+static long queuedTrades = 0;
+
 // Function to handle the change of the keepRunning boolean
 void intHandler(int dummy) { keepRunning = 0; }
 
-// The JSON paths/labels that we are interested in
-static const char *const tok[] = {
-    "data[].p",
-    "data[].s",
-    "data[].t",
-    "data[].v",
-};
-
-static unsigned long long get_timestamp() {
-  struct timeval tv;
-
-  gettimeofday(&tv, NULL);
-
-  unsigned long long millisecondsSinceEpoch =
-      (unsigned long long)(tv.tv_sec) * 1000 +
-      (unsigned long long)(tv.tv_usec) / 1000;
-  return millisecondsSinceEpoch;
-}
-
-static void findataFromJson(findata *transaction, const char *label,
-                            char *buf) {
-  if (strcmp(label, "data[].p") == 0) {
-    transaction->price = (char *)malloc(strlen(buf) + 1);
-    strcpy(transaction->price, buf);
-  } else if (strcmp(label, "data[].s") == 0) {
-    transaction->symbol = (char *)malloc(strlen(buf) + 1);
-    strcpy(transaction->symbol, buf);
-  } else if (strcmp(label, "data[].t") == 0) {
-    transaction->timestamp = (char *)malloc(strlen(buf) + 1);
-    strcpy(transaction->timestamp, buf);
-  } else if (strcmp(label, "data[].v") == 0) {
-    transaction->volume = (char *)malloc(strlen(buf) + 1);
-    strcpy(transaction->volume, buf);
-  } else
-    printf("Label undefined\n");
-}
-
 // Callback function for the LEJP JSON Parser
 static signed char cb(struct lejp_ctx *ctx, char reason) {
   findata *transaction = (findata *)ctx->user;
@@ -193,6 +89,7 @@ static signed char cb(struct lejp_ctx *ctx, char reason) {
     findataFromJson(transaction, ctx->path, ctx->buf);
     if (ctx->path_match == last_element_from_tok) {
       queueAdd(fifo, transaction);
+      queuedTrades++;
     }
   }
   if (reason == LEJPCB_COMPLETE) {
@@ -269,9 +166,7 @@ static int ws_service_callback(struct lws *wsi,
     // UNCOMMENT for printing the message on the terminal
     // printf(KCYN_L"[Main Service] Client received:%s\n"RESET, (char *)in);
 
-    // Print that messages are being received
-    printf(KCYN_L "\r[Main Service] Client receiving messages" RESET);
-    fflush(stdout);
+    metricsAdd(&stats.messages, 1);
 
     // Initialize a LEJP JSON parser, and pass it the incoming message
     char *msg = (char *)in;
@@ -283,6 +178,7 @@ static int ws_service_callback(struct lws *wsi,
     int m = lejp_parse(&ctx, (uint8_t *)msg, strlen(msg));
     if (m < 0 && m != LEJP_CONTINUE) {
       lwsl_err("parse failed %d\n", m);
+      metricsAdd(&stats.parseFailures, 1);
     }
 
     break;
@@ -336,38 +232,138 @@ struct lws_context *context = NULL;
 struct lws_context_creation_info info;
 struct lws_client_connect_info clientConnectionInfo;
 
+static void usage() {
+  printf("USAGE: ./bin/client [-m <metrics port, 0 disables>] "
+         "[-l <seconds between metrics lines on stderr, 0 disables>] "
+         "[-s <seconds between state snapshots, 0 disables>] "
+         "[-f <snapshot file>] "
+         "[-b <threads to backfill from the logs without a snapshot>] "
+         "[-c <min consumers>] [-C <max consumers, up to %d>]\n",
+         POOL_MAX_CONSUMERS);
+  exit(1);
+}
+
+// Opens a csv log. On a warm restart the logs of the previous run are
+// continued, else they are truncated like on every cold start.
+static FILE *openLog(const char *path, bool append, void (*header)(FILE *)) {
+  FILE *fp = fopen(path, append ? "a" : "w");
+  if (fp == NULL) {
+    perror(path);
+    exit(1);
+  }
+  if (ftell(fp) == 0)
+    header(fp);
+  return fp;
+}
+
+// Restores the symbols from the snapshot and reconciles them with the time the
+// client was down. A candlestick whose minute ended during the downtime is
+// written out and added to the moving average, and a moving average window
+// that lies entirely in the downtime is dropped. Returns false if there was
+// nothing to restore.
+static bool restoreSnapshot() {
+  snapshot s;
+  if (snapshotLoad(&s, snapshotPath))
+    return false;
+
+  uint64_t now = get_timestamp();
+  uint64_t elapsed = now > s.candleStart ? now - s.candleStart : 0;
+  uint64_t minutes = elapsed / 60000;
+
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    symbol *sym = &symbols[i];
+    sym->ma = s.symbols[i].ma;
+    if (minutes == 0) {
+      sym->c = s.symbols[i].c;
+      continue;
+    }
+    if (minutes > MOVING_AVERAGE_TIMESPAN_MINUTES) {
+      movingAverageInit(&sym->ma);
+      continue;
+    }
+    if (!s.symbols[i].c.isDefault) {
+      saveCandlestick(&s.symbols[i].c, sym->fp_candlestick,
+                      s.candleStart + 60000);
+      addDataPoint(&sym->ma, getMean(&s.symbols[i].c));
+    }
+  }
+
+  // Stay on the minute grid of the previous run
+  minutesSinceStart = s.minutesSinceStart + minutes;
+  candleStart = s.candleStart + minutes * 60000;
+
+  printf(KGRN "[Main] restored state of %llu s ago.\n" RESET,
+         (unsigned long long)(now - s.savedAt) / 1000);
+  return true;
+}
+
 // Main function
-int main(void) {
+int main(int argc, char *argv[]) {
+  int metricsPort = METRICS_PORT;
+  int metricsLog = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:l:s:f:b:c:C:")) != -1) {
+    switch (opt) {
+    case 's':
+      snapshotInterval = atoi(optarg);
+      break;
+    case 'f':
+      snapshotPath = optarg;
+      break;
+    case 'b':
+      backfillThreads = atoi(optarg);
+      break;
+    case 'c':
+      minConsumers = atoi(optarg);
+      break;
+    case 'C':
+      maxConsumers = atoi(optarg);
+      break;
+    case 'm':
+      metricsPort = atoi(optarg);
+      break;
+    case 'l':
+      metricsLog = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (minConsumers < 1 || maxConsumers > POOL_MAX_CONSUMERS ||
+      minConsumers > maxConsumers)
+    usage();
+
   // Set intHandle to handle the SIGINT signal
   // (Used for terminating the client)
   signal(SIGINT, intHandler);
 
-  amzn_fp = fopen("logs_amzn.csv", "w");
-  msft_fp = fopen("logs_msft.csv", "w");
-  binance_fp = fopen("logs_binance.csv", "w");
-  icm_fp = fopen("logs_icm.csv", "w");
-  transactionsHeader(amzn_fp);
-  transactionsHeader(msft_fp);
-  transactionsHeader(binance_fp);
-  transactionsHeader(icm_fp);
-
-  amzn_fp_candlestick = fopen("logs_amzn_candlestick.csv", "w");
-  msft_fp_candlestick = fopen("logs_msft_candlestick.csv", "w");
-  binance_fp_candlestick = fopen("logs_binance_candlestick.csv", "w");
-  icm_fp_candlestick = fopen("logs_icm_candlestick.csv", "w");
-  candlesticksHeader(amzn_fp_candlestick);
-  candlesticksHeader(msft_fp_candlestick);
-  candlesticksHeader(binance_fp_candlestick);
-  candlesticksHeader(icm_fp_candlestick);
-
-  amzn_fp_ma = fopen("logs_amzn_ma.csv", "w");
-  msft_fp_ma = fopen("logs_msft_ma.csv", "w");
-  binance_fp_ma = fopen("logs_binance_ma.csv", "w");
-  icm_fp_ma = fopen("logs_icm_ma.csv", "w");
-  movingAverageHeader(amzn_fp_ma);
-  movingAverageHeader(msft_fp_ma);
-  movingAverageHeader(binance_fp_ma);
-  movingAverageHeader(icm_fp_ma);
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    candlestickInit(&symbols[i].c);
+    movingAverageInit(&symbols[i].ma);
+  }
+  candleStart = get_timestamp();
+
+  bool warm = snapshotInterval > 0 && access(snapshotPath, R_OK) == 0;
+  bool restore = warm;
+  if (!warm && backfillThreads > 0 &&
+      backfill(backfillThreads, candleStart) >= 0) {
+    // Hand over to the live feed on the minute grid of the trade timestamps
+    warm = true;
+    candleStart -= candleStart % 60000;
+  }
+  char path[64];
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    sprintf(path, "logs_%s.csv", symbols[i].logName);
+    symbols[i].transaction = openLog(path, warm, transactionsHeader);
+
+    sprintf(path, "logs_%s_candlestick.csv", symbols[i].logName);
+    symbols[i].fp_candlestick = openLog(path, warm, candlesticksHeader);
+
+    sprintf(path, "logs_%s_ma.csv", symbols[i].logName);
+    symbols[i].fp_ma = openLog(path, warm, movingAverageHeader);
+  }
+  if (restore)
+    restoreSnapshot();
 
   memset(&info, 0, sizeof info);
 
@@ -429,29 +425,29 @@ int main(void) {
   mux = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
   pthread_mutex_init(mux, NULL);
 
-  fifo = queueInit();
+  fifo = queueInit(QUEUESIZE);
   if (fifo == NULL) {
     fprintf(stderr, "main: Queue Init failed.\n");
     exit(1);
   }
 
-  amzn_candlestick = candlestickInit();
-  msft_candlestick = candlestickInit();
-  binance_candlestick = candlestickInit();
-  icm_candlestick = candlestickInit();
-
-  movingAverageInit(&amzn_ma);
-  movingAverageInit(&msft_ma);
-  movingAverageInit(&binance_ma);
-  movingAverageInit(&icm_ma);
-
-  isConsumerFinished = (bool *)malloc(NUM_CON_THREADS * sizeof(bool));
-  for (int i = 0; i < NUM_CON_THREADS; i++) {
+  isConsumerFinished = (bool *)malloc(maxConsumers * sizeof(bool));
+  for (int i = 0; i < maxConsumers; i++) {
     isConsumerFinished[i] = false;
   }
+  poolInit(minConsumers, maxConsumers);
+
+  if (metricsStart(metricsPort, metricsLog)) {
+    fprintf(stderr, "main: Metrics init failed.\n");
+  } else if (metricsPort) {
+    printf(KGRN "[Main] metrics on http://127.0.0.1:%d/metrics\n" RESET,
+           metricsPort);
+  }
 
   // todo: check returned code
   pthread_create(&scheduler, NULL, schedule, NULL);
+  if (snapshotInterval > 0)
+    pthread_create(&snapshotter, NULL, snapshotLoop, NULL);
 
   int rc;
   for (int i = 0; i < NUM_PRO_THREADS; i++) {
@@ -461,12 +457,14 @@ int main(void) {
     }
   }
 
-  for (int i = 0; i < NUM_CON_THREADS; i++) {
+  // Consumers above the active count stay parked until the pool grows
+  for (int i = 0; i < maxConsumers; i++) {
     conData[i].tid = i;
     if (rc = pthread_create(&consumers[i], NULL, consumer, &conData[i])) {
       printf("Error creating threads %d\n", rc);
     }
   }
+  pthread_create(&poolSizer, NULL, poolController, NULL);
 
   for (int i = 0; i < NUM_PRO_THREADS; i++) {
     pthread_join(producers[i], NULL);
@@ -474,37 +472,41 @@ int main(void) {
   }
 
   areProducersFinished = true;
+  if (snapshotInterval > 0)
+    pthread_join(snapshotter, NULL);
 
-  // spam signals until all consumer threads have finished
-  // Fix: Use broadcast
-  while (1) {
-    printf("Send signal if someone is blocked\n");
-    pthread_cond_signal(fifo->notEmpty); // unblock the waited thread
-    if (areConsumersFinished())
-      break;
-    usleep(10); // hibernate
-  }
+  poolShutdown();
+  pthread_join(poolSizer, NULL);
 
-  for (int i = 0; i < NUM_CON_THREADS; i++) {
+  for (int i = 0; i < maxConsumers; i++) {
     pthread_join(consumers[i], NULL);
     printf("Joined consumer id: %d\n", i);
   }
 
   pthread_join(scheduler, NULL);
+  metricsStop();
+
+  // Leave the latest state behind for the next start
+  if (snapshotInterval > 0) {
+    snapshot s;
+    snapshotTake(&s, candleStart, minutesSinceStart);
+    snapshotSave(&s, snapshotPath);
+  }
 
   printf(KRED "\n[Main] Closing client\n" RESET);
   lws_context_destroy(context);
   queueDelete(fifo);
-  fclose(amzn_fp);
-  fclose(msft_fp);
-  fclose(binance_fp);
-  fclose(icm_fp);
+  pthread_mutex_destroy(mux);
+  free(mux);
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    fclose(symbols[i].transaction);
+  }
   return 0;
 }
 
 bool areConsumersFinished() {
   bool finish = isConsumerFinished[0];
-  for (int i = 1; i < NUM_CON_THREADS; i++) {
+  for (int i = 1; i < maxConsumers; i++) {
     finish = finish && isConsumerFinished[i];
   }
   return finish;
@@ -513,6 +515,7 @@ bool areConsumersFinished() {
 void *producer(void *args) {
   pthread_data *data = (pthread_data *)args;
   struct lws *wsi = NULL;
+  static bool connectedOnce = false;
   // time_t start_time = time(NULL);
   // while (difftime(time(NULL), start_time) < 20.0) {
   while (keepRunning) {
@@ -532,18 +535,29 @@ void *producer(void *args) {
       }
       printf(KGRN "[Main] wsi creation success.\n" RESET);
       connection_flag = 1;
+      if (connectedOnce)
+        metricsAdd(&stats.reconnects, 1);
+      connectedOnce = true;
     }
 
-    while (fifo->full) {
-      printf("producer: queue FULL.\n");
-      pthread_cond_wait(fifo->notFull, mux);
+    if (queueFull(fifo)) {
+      metricsAdd(&stats.queueFull, 1);
+      uint64_t start = monotonicNs();
+      while (queueFull(fifo)) {
+        pthread_cond_wait(fifo->notFull, mux);
+      }
+      metricsAdd(&stats.producerBlockedNs, monotonicNs() - start);
     }
 
     // Service websocket activity
     // only one thread should listen maybe?
     lws_service(context, 0);
+    long queued = queuedTrades;
+    queuedTrades = 0;
     pthread_mutex_unlock(mux);
-    pthread_cond_signal(fifo->notEmpty);
+    // Pings and other messages without trades leave the consumers parked
+    if (queued > 0)
+      poolNotify();
   }
   return (NULL);
 }
@@ -552,258 +566,76 @@ void *schedule(void *args) {
   while (1) {
     if (areConsumersFinished())
       break;
-    sleep(60);
-    minutesSinceStart += 1;
+    // Every minute ends on the grid of the first one, which a backfill or a
+    // restore may have started before this run. Only this thread moves it.
+    uint64_t end = candleStart + 60000, now = get_timestamp();
+    if (end > now) {
+      struct timespec t = {(end - now) / 1000, (end - now) % 1000 * 1000000};
+      while (nanosleep(&t, &t) != 0)
+        ;
+    }
     pthread_mutex_lock(mux);
-    fprintf(amzn_fp, "\n");
-    fprintf(msft_fp, "\n");
-    fprintf(binance_fp, "\n");
-    fprintf(icm_fp, "\n");
-
-    saveCandlestick(amzn_candlestick, amzn_fp_candlestick);
-    saveCandlestick(msft_candlestick, msft_fp_candlestick);
-    saveCandlestick(binance_candlestick, binance_fp_candlestick);
-    saveCandlestick(icm_candlestick, icm_fp_candlestick);
-
-    addDataPoint(&amzn_ma, getMean(amzn_candlestick));
-    addDataPoint(&msft_ma, getMean(msft_candlestick));
-    addDataPoint(&binance_ma, getMean(binance_candlestick));
-    addDataPoint(&icm_ma, getMean(icm_candlestick));
-
-    if (minutesSinceStart % MOVING_AVERAGE_TIMESPAN_MINUTES == 0) {
-      saveMovingAverage(&amzn_ma, amzn_fp_ma);
-      saveMovingAverage(&msft_ma, msft_fp_ma);
-      saveMovingAverage(&binance_ma, binance_fp_ma);
-      saveMovingAverage(&icm_ma, icm_fp_ma);
+    minutesSinceStart += 1;
+    candleStart = end;
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+      symbol *s = &symbols[i];
+      fprintf(s->transaction, "\n");
+      saveCandlestick(&s->c, s->fp_candlestick, end);
+      addDataPoint(&s->ma, getMean(&s->c));
+      if (minutesSinceStart % MOVING_AVERAGE_TIMESPAN_MINUTES == 0) {
+        saveMovingAverage(&s->ma, s->fp_ma);
+      }
+      candlestickInit(&s->c);
     }
 
-    msft_candlestick = candlestickInit();
-    amzn_candlestick = candlestickInit();
-    binance_candlestick = candlestickInit();
-    icm_candlestick = candlestickInit();
-
     pthread_mutex_unlock(mux);
   }
   return (NULL);
 }
 
-double getMean(candlestickMinute *c) {
-  if (c->numTransactions == 0)
-    return 0;
-  return c->totalPrice / c->numTransactions;
-}
-
-void addDataPoint(movingAverage *ma, double price) {
-  if (price == 0)
-    return;
-  // Remove the oldest data point from totals if the window is full
-  if (ma->count == MOVING_AVERAGE_TIMESPAN_MINUTES) {
-    ma->totalPrice -= ma->prices[ma->index];
-  } else {
-    ma->count++;
-  }
-
-  ma->prices[ma->index] = price;
-  ma->totalPrice += price;
-
-  ma->index = (ma->index + 1) % MOVING_AVERAGE_TIMESPAN_MINUTES;
-}
-
-void saveCandlestick(candlestickMinute *c, FILE *fp) {
-  fprintf(fp, "%lf,%lf,%lf,%lf,%lf,%lf,%lu,%lf,%llu\n", c->open, c->close,
-          c->min, c->max, c->vol, c->totalPrice, c->numTransactions, getMean(c),
-          get_timestamp());
-}
-
-void saveMovingAverage(movingAverage *ma, FILE *fp) {
-  double value;
-  if (ma->count == 0) {
-    value = 0;
-  } else {
-    value = ma->totalPrice / ma->count;
+void *snapshotLoop(void *args) {
+  snapshot s;
+  int seconds = 0;
+  while (keepRunning) {
+    sleep(1);
+    if (++seconds % snapshotInterval != 0)
+      continue;
+    pthread_mutex_lock(mux);
+    snapshotTake(&s, candleStart, minutesSinceStart);
+    pthread_mutex_unlock(mux);
+    snapshotSave(&s, snapshotPath);
   }
-  fprintf(fp, "%lf,%lf,%u,%llu\n", value, ma->totalPrice, ma->count,
-          get_timestamp());
+  return (NULL);
 }
 
 void *consumer(void *args) {
   pthread_data *data = (pthread_data *)args;
 
-  while (1) {
+  while (poolPark(data->tid)) {
     pthread_mutex_lock(mux);
-    while (fifo->empty && !areProducersFinished) {
-      printf("consumer: queue EMPTY\n");
-      pthread_cond_wait(fifo->notEmpty, mux);
+    if (queueEmpty(fifo)) {
+      unsigned seq = poolItemsSeq();
+      pthread_mutex_unlock(mux);
+      uint64_t start = monotonicNs();
+      poolWaitItems(seq);
+      metricsAdd(&stats.consumerIdleNs, monotonicNs() - start);
+      continue;
     }
     queueDel(fifo);
+    poolObserve(fifo->lastWaitNs);
     pthread_mutex_unlock(mux);
     pthread_cond_signal(fifo->notFull);
-    if (areProducersFinished && fifo->empty)
-      break;
   }
 
+  // The pool shut down: every consumer helps drain what is left
+  pthread_mutex_lock(mux);
+  while (!queueEmpty(fifo)) {
+    queueDel(fifo);
+  }
+  pthread_mutex_unlock(mux);
+
   printf("Consumer Finished id:%d\n", data->tid);
   isConsumerFinished[data->tid] = true;
 
   return (NULL);
 }
-
-void transactionsHeader(FILE *fp) {
-  fprintf(fp, "Price,Symbol,Timestamp,Volume,Posttimestamp\n");
-}
-
-void candlesticksHeader(FILE *fp) {
-  fprintf(
-      fp,
-      "Open,Close,Low,High,Volume,TotalPrice,NumTransactions,Mean,Timestamp\n");
-}
-
-void movingAverageHeader(FILE *fp) {
-  fprintf(fp, "Price,Total,Count,Timestamp\n");
-}
-
-candlestickMinute *candlestickInit() {
-  candlestickMinute *c;
-  c = (candlestickMinute *)malloc(sizeof(candlestickMinute));
-  c->close = 0;
-  c->open = 0;
-  c->max = 0;
-  c->min = 0;
-  c->vol = 0;
-  c->totalPrice = 0;
-  c->numTransactions = 0;
-  c->isDefault = true;
-  return c;
-}
-
-void movingAverageInit(movingAverage *ma) {
-  ma->index = 0;
-  ma->count = 0;
-  ma->totalPrice = 0.0;
-  for (int i = 0; i < MOVING_AVERAGE_TIMESPAN_MINUTES; i++) {
-    ma->prices[i] = 0.0;
-  }
-}
-
-queue *queueInit() {
-  queue *q;
-
-  q = (queue *)malloc(sizeof(queue));
-  if (q == NULL)
-    return (NULL);
-
-  q->empty = 1;
-  q->full = 0;
-  q->head = 0;
-  q->tail = 0;
-
-  q->notFull = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
-  pthread_cond_init(q->notFull, NULL);
-
-  q->notEmpty = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
-  pthread_cond_init(q->notEmpty, NULL);
-
-  for (int i = 0; i < QUEUESIZE; i++) {
-    q->buf[i] = DEFAULT_FINDATA;
-  }
-
-  return (q);
-}
-
-void queueDelete(queue *q) {
-  pthread_cond_destroy(q->notFull);
-  free(q->notFull);
-  pthread_cond_destroy(q->notEmpty);
-  free(q->notEmpty);
-  pthread_mutex_destroy(mux);
-  free(mux);
-  free(q);
-}
-
-void queueAdd(queue *q, findata *transaction) {
-  // todo, maybe memcpy
-  q->buf[q->tail].price = transaction->price;
-  q->buf[q->tail].symbol = transaction->symbol;
-  q->buf[q->tail].timestamp = transaction->timestamp;
-  q->buf[q->tail].volume = transaction->volume;
-
-  q->tail++;
-  if (q->tail == QUEUESIZE)
-    q->tail = 0;
-  if (q->tail == q->head)
-    q->full = 1;
-  q->empty = 0;
-
-  return;
-}
-
-void queueDel(queue *q) {
-  if (q->empty) {
-    printf("\033[1mThere is nothing to delete. Queue empty. Aborting\033[0m\n");
-    return;
-  }
-
-  findata transaction = q->buf[q->head];
-  saveTransaction(&transaction);
-
-  q->head++;
-  if (q->head == QUEUESIZE)
-    q->head = 0;
-  if (q->head == q->tail)
-    q->empty = 1;
-  q->full = 0;
-
-  return;
-}
-
-void saveTransaction(findata *transaction) {
-  FILE *fp;
-  candlestickMinute *c;
-  if (strcmp(transaction->symbol, "AMZN") == 0) {
-    fp = amzn_fp;
-    c = amzn_candlestick;
-  } else if (strcmp(transaction->symbol, "MSFT") == 0) {
-    fp = msft_fp;
-    c = msft_candlestick;
-  } else if (strcmp(transaction->symbol, "BINANCE:BTCUSDT") == 0) {
-    fp = binance_fp;
-    c = binance_candlestick;
-  } else if (strcmp(transaction->symbol, "IC MARKETS:1") == 0) {
-    fp = icm_fp;
-    c = icm_candlestick;
-  } else {
-    printf("Error returning file descriptior: Not found\n");
-  }
-
-  fprintf(fp, "%s,%s,%s,%s,%llu\n", transaction->price, transaction->symbol,
-          transaction->timestamp, transaction->volume, get_timestamp());
-  updateCandlestick(c, transaction);
-}
-
-void updateCandlestick(candlestickMinute *c, findata *transaction) {
-  double price;
-  double vol;
-  uint64_t timestamp;
-  sscanf(transaction->price, "%lf", &price);
-  sscanf(transaction->volume, "%lf", &vol);
-  sscanf(transaction->timestamp, "%lu", &timestamp);
-
-  if (c->isDefault) {
-    c->open = price;
-    c->min = price;
-    c->max = price;
-  } else {
-    if (c->min > price) {
-      c->min = price;
-    }
-    if (c->max < price) {
-      c->max = price;
-    }
-  }
-
-  c->close = price;
-  c->numTransactions += 1;
-  c->totalPrice += price;
-  c->vol += vol;
-  c->isDefault = false;
-}
@@ -0,0 +1,133 @@
+#include "csvscan.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  const char *begin, *end;
+  int chunk;
+  csvChunkFn fn;
+  void *arg;
+  pthread_t thread;
+  bool started;
+} chunkTask;
+
+int csvOpen(csvFile *f, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  f->size = st.st_size;
+  f->data = NULL;
+  if (f->size > 0) {
+    void *data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    madvise(data, f->size, MADV_SEQUENTIAL);
+    f->data = (const char *)data;
+  }
+  close(fd);
+  return 0;
+}
+
+void csvClose(csvFile *f) {
+  if (f->data)
+    munmap((void *)f->data, f->size);
+  f->data = NULL;
+  f->size = 0;
+}
+
+static void *runChunk(void *args) {
+  chunkTask *t = (chunkTask *)args;
+  t->fn(t->begin, t->end, t->chunk, t->arg);
+  return (NULL);
+}
+
+int csvScan(csvFile *f, int numChunks, csvChunkFn fn, void *arg) {
+  if (f->size == 0)
+    return 0;
+  if (numChunks < 1)
+    numChunks = 1;
+
+  chunkTask *tasks = (chunkTask *)malloc(numChunks * sizeof(chunkTask));
+  if (tasks == NULL) {
+    // No memory for the tasks: the calling thread scans the whole file
+    fn(f->data, f->data + f->size, 0, arg);
+    return 1;
+  }
+
+  // Cut at the first newline after every even split point
+  const char *end = f->data + f->size;
+  const char *begin = f->data;
+  int n = 0;
+  for (int i = 0; i < numChunks && begin < end; i++) {
+    const char *cut = f->data + f->size / numChunks * (i + 1);
+    if (i == numChunks - 1 || cut >= end) {
+      cut = end;
+    } else if (cut < begin) {
+      continue;
+    } else {
+      const char *nl = memchr(cut, '\n', end - cut);
+      cut = nl ? nl + 1 : end;
+    }
+    tasks[n] = (chunkTask){begin, cut, n, fn, arg};
+    begin = cut;
+    n++;
+  }
+
+  // The calling thread takes the first chunk, and any chunk whose thread could
+  // not be created
+  for (int i = 1; i < n; i++) {
+    tasks[i].started =
+        pthread_create(&tasks[i].thread, NULL, runChunk, &tasks[i]) == 0;
+  }
+  runChunk(&tasks[0]);
+  for (int i = 1; i < n; i++) {
+    if (tasks[i].started)
+      pthread_join(tasks[i].thread, NULL);
+    else
+      runChunk(&tasks[i]);
+  }
+
+  free(tasks);
+  return n;
+}
+
+// memchr is vectorized by the C library (SSE2/AVX2 on x86, NEON on arm), so it
+// is used for every delimiter search
+const char *csvNextLine(const char **p, const char *end, const char **lineEnd) {
+  if (*p >= end)
+    return NULL;
+  const char *line = *p;
+  const char *nl = memchr(line, '\n', end - line);
+  *lineEnd = nl ? nl : end;
+  *p = nl ? nl + 1 : end;
+  return line;
+}
+
+int csvFields(const char *line, const char *lineEnd, const char **fields,
+              int maxFields) {
+  int n = 0;
+  while (n < maxFields) {
+    fields[n++] = line;
+    const char *comma = memchr(line, ',', lineEnd - line);
+    if (comma == NULL)
+      break;
+    line = comma + 1;
+  }
+  return n;
+}
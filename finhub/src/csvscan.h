@@ -0,0 +1,33 @@
+#ifndef CSVSCAN_H
+#define CSVSCAN_H
+
+#include <stddef.h>
+
+// A csv file mapped read only in memory
+typedef struct {
+  const char *data;
+  size_t size;
+} csvFile;
+
+// Called once per chunk from its own thread. A chunk holds whole lines only.
+typedef void (*csvChunkFn)(const char *begin, const char *end, int chunk,
+                           void *arg);
+
+int csvOpen(csvFile *f, const char *path);
+void csvClose(csvFile *f);
+
+// Splits the file in up to numChunks pieces on line boundaries and runs fn on
+// each of them in parallel. Returns the number of chunks.
+int csvScan(csvFile *f, int numChunks, csvChunkFn fn, void *arg);
+
+// Returns the line starting at *p, without its newline, and advances *p past
+// it. Returns NULL at end.
+const char *csvNextLine(const char **p, const char *end, const char **lineEnd);
+
+// Points fields[i] at the start of every comma separated field of the line.
+// Fields are not terminated; the number parsers stop at the delimiter.
+// Returns the number of fields found.
+int csvFields(const char *line, const char *lineEnd, const char **fields,
+              int maxFields);
+
+#endif
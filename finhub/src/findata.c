@@ -0,0 +1,392 @@
+#include "findata.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+const findata DEFAULT_FINDATA = {"-1", "-1", "-1", "-1"};
+
+symbol symbols[NUM_SYMBOLS] = {
+    {.name = "AMZN", .logName = "amzn"},
+    {.name = "MSFT", .logName = "msft"},
+    {.name = "BINANCE:BTCUSDT", .logName = "binance"},
+    {.name = "IC MARKETS:1", .logName = "icm"},
+};
+
+const char *const tok[4] = {
+    "data[].p",
+    "data[].s",
+    "data[].t",
+    "data[].v",
+};
+
+unsigned long long get_timestamp() {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  unsigned long long millisecondsSinceEpoch =
+      (unsigned long long)(tv.tv_sec) * 1000 +
+      (unsigned long long)(tv.tv_usec) / 1000;
+  return millisecondsSinceEpoch;
+}
+
+static const int64_t pow10[19] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000, 10000000000, 100000000000, 1000000000000, 10000000000000,
+    100000000000000, 1000000000000000, 10000000000000000, 100000000000000000,
+    1000000000000000000};
+
+static inline bool isDigit(char c) { return (unsigned char)(c - '0') < 10; }
+
+// Past this the exponent and the count of fraction digits stop growing. A
+// value that far from 1 is 0 or too large anyway.
+#define FIXED_MAX_EXP 10000
+
+// Parses a json number into a fixed point decimal. The digits are read into
+// one integer and the exponent, the fraction digits and FIXED_DECIMALS are
+// applied together, so digits past FIXED_DECIMALS are truncated once, after
+// the exponent. Accepts an exponent, as finnhub sends very small crypto
+// volumes like 1e-05. The feed is not trusted: returns false, leaving *out
+// alone, when the value is too large for fixed_t.
+bool fixedFromString(const char *s, fixed_t *out) {
+  bool negative = *s == '-';
+  s += negative || *s == '+';
+
+  // The value is digits * 10^(scale - FIXED_DECIMALS). Digits that do not fit
+  // in digits are dropped, in the integer part by raising scale.
+  int64_t digits = 0;
+  int scale = FIXED_DECIMALS;
+  bool full = false;
+  for (; isDigit(*s); s++) {
+    int64_t d;
+    if (full || __builtin_mul_overflow(digits, 10, &d) ||
+        __builtin_add_overflow(d, *s - '0', &d)) {
+      full = true;
+      scale += scale < FIXED_MAX_EXP;
+      continue;
+    }
+    digits = d;
+  }
+  if (*s == '.') {
+    s++;
+    for (; isDigit(*s); s++) {
+      int64_t d;
+      if (full || scale <= -FIXED_MAX_EXP ||
+          __builtin_mul_overflow(digits, 10, &d) ||
+          __builtin_add_overflow(d, *s - '0', &d)) {
+        full = true;
+        continue;
+      }
+      digits = d;
+      scale--;
+    }
+  }
+
+  if (*s == 'e' || *s == 'E') {
+    s++;
+    bool negativeExp = *s == '-';
+    s += negativeExp || *s == '+';
+    int exp = 0;
+    for (; isDigit(*s); s++) {
+      if (exp < FIXED_MAX_EXP)
+        exp = exp * 10 + (*s - '0');
+    }
+    scale += negativeExp ? -exp : exp;
+  }
+
+  fixed_t x = digits;
+  if (x != 0 && scale > 0) {
+    if (scale > 18 || __builtin_mul_overflow(x, pow10[scale], &x))
+      return false;
+  } else if (scale < 0) {
+    x = scale < -18 ? 0 : x / pow10[-scale];
+  }
+  *out = negative ? -x : x;
+  return true;
+}
+
+double fixedToDouble(fixed_t x) { return (double)x / FIXED_SCALE; }
+
+uint64_t uintFromString(const char *s) {
+  uint64_t x = 0;
+  while (isDigit(*s))
+    x = x * 10 + (*s++ - '0');
+  return x;
+}
+
+void findataFromJson(findata *transaction, const char *label, char *buf) {
+  if (strcmp(label, "data[].p") == 0) {
+    transaction->price = (char *)malloc(strlen(buf) + 1);
+    strcpy(transaction->price, buf);
+  } else if (strcmp(label, "data[].s") == 0) {
+    transaction->symbol = (char *)malloc(strlen(buf) + 1);
+    strcpy(transaction->symbol, buf);
+  } else if (strcmp(label, "data[].t") == 0) {
+    transaction->timestamp = (char *)malloc(strlen(buf) + 1);
+    strcpy(transaction->timestamp, buf);
+  } else if (strcmp(label, "data[].v") == 0) {
+    transaction->volume = (char *)malloc(strlen(buf) + 1);
+    strcpy(transaction->volume, buf);
+  } else
+    metricsAdd(&stats.parseFailures, 1);
+}
+
+void findataFree(findata *transaction) {
+  free(transaction->price);
+  free(transaction->symbol);
+  free(transaction->timestamp);
+  free(transaction->volume);
+}
+
+symbol *symbolLookup(const char *name) {
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    if (strcmp(name, symbols[i].name) == 0)
+      return &symbols[i];
+  }
+  return NULL;
+}
+
+// The mean is rounded to the nearest FIXED_SCALE unit
+fixed_t getMean(candlestickMinute *c) {
+  if (c->numTransactions == 0)
+    return 0;
+  int64_t n = c->numTransactions;
+  return (c->totalPrice + n / 2) / n;
+}
+
+void addDataPoint(movingAverage *ma, fixed_t price) {
+  if (price == 0)
+    return;
+  // Remove the oldest data point from totals if the window is full
+  if (ma->count == MOVING_AVERAGE_TIMESPAN_MINUTES) {
+    ma->totalPrice -= ma->prices[ma->index];
+  } else {
+    ma->count++;
+  }
+
+  ma->prices[ma->index] = price;
+  ma->totalPrice += price;
+
+  ma->index = (ma->index + 1) % MOVING_AVERAGE_TIMESPAN_MINUTES;
+}
+
+// Timestamp is when the candlestick is written, so the intervals between
+// them show the drift of the scheduler, and MinuteEnd the minute it is of
+void saveCandlestick(candlestickMinute *c, FILE *fp, uint64_t endMs) {
+  fprintf(fp, "%lf,%lf,%lf,%lf,%lf,%lf,%lu,%lf,%llu,%llu\n",
+          fixedToDouble(c->open), fixedToDouble(c->close),
+          fixedToDouble(c->min), fixedToDouble(c->max), fixedToDouble(c->vol),
+          fixedToDouble(c->totalPrice), c->numTransactions,
+          fixedToDouble(getMean(c)), get_timestamp(),
+          (unsigned long long)endMs);
+}
+
+void saveMovingAverage(movingAverage *ma, FILE *fp) {
+  fixed_t value;
+  if (ma->count == 0) {
+    value = 0;
+  } else {
+    value = (ma->totalPrice + ma->count / 2) / ma->count;
+  }
+  fprintf(fp, "%lf,%lf,%u,%llu\n", fixedToDouble(value),
+          fixedToDouble(ma->totalPrice), ma->count, get_timestamp());
+}
+
+void transactionsHeader(FILE *fp) {
+  fprintf(fp, "Price,Symbol,Timestamp,Volume,Posttimestamp\n");
+}
+
+void candlesticksHeader(FILE *fp) {
+  fprintf(fp, "Open,Close,Low,High,Volume,TotalPrice,NumTransactions,Mean,"
+              "Timestamp,MinuteEnd\n");
+}
+
+void movingAverageHeader(FILE *fp) {
+  fprintf(fp, "Price,Total,Count,Timestamp\n");
+}
+
+void candlestickInit(candlestickMinute *c) {
+  c->close = 0;
+  c->open = 0;
+  c->max = 0;
+  c->min = 0;
+  c->vol = 0;
+  c->totalPrice = 0;
+  c->numTransactions = 0;
+  c->isDefault = true;
+}
+
+// Folds the candlestick of a later part of the same minute into c
+void candlestickMerge(candlestickMinute *c, candlestickMinute *later) {
+  if (later->isDefault)
+    return;
+  if (c->isDefault) {
+    *c = *later;
+    return;
+  }
+  if (c->min > later->min)
+    c->min = later->min;
+  if (c->max < later->max)
+    c->max = later->max;
+  c->close = later->close;
+  c->numTransactions += later->numTransactions;
+  c->totalPrice += later->totalPrice;
+  c->vol += later->vol;
+}
+
+void movingAverageInit(movingAverage *ma) {
+  ma->index = 0;
+  ma->count = 0;
+  ma->totalPrice = 0;
+  for (int i = 0; i < MOVING_AVERAGE_TIMESPAN_MINUTES; i++) {
+    ma->prices[i] = 0;
+  }
+}
+
+queue *queueInit(long size) {
+  queue *q;
+
+  q = (queue *)malloc(sizeof(queue));
+  if (q == NULL)
+    return (NULL);
+
+  if (!findataRingInit(&q->ring, size)) {
+    free(q);
+    return (NULL);
+  }
+  q->spill = NULL;
+  q->spillHead = q->spillLen = q->spillCap = 0;
+  q->lastWaitNs = 0;
+
+  q->size = size;
+  atomic_store(&stats.queueSize, size);
+
+  q->notFull = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
+  pthread_cond_init(q->notFull, NULL);
+
+  q->notEmpty = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
+  pthread_cond_init(q->notEmpty, NULL);
+
+  return (q);
+}
+
+void queueDelete(queue *q) {
+  pthread_cond_destroy(q->notFull);
+  free(q->notFull);
+  pthread_cond_destroy(q->notEmpty);
+  free(q->notEmpty);
+  findataRingDestroy(&q->ring);
+  free(q->spill);
+  free(q);
+}
+
+// Appends to the spill list, false if it can not grow
+static bool spillPush(queue *q, queueItem *item) {
+  if (q->spillHead + q->spillLen == q->spillCap) {
+    if (q->spillHead > 0) {
+      memmove(q->spill, q->spill + q->spillHead,
+              q->spillLen * sizeof(queueItem));
+      q->spillHead = 0;
+    } else {
+      long cap = q->spillCap ? 2 * q->spillCap : q->size;
+      queueItem *spill =
+          (queueItem *)realloc(q->spill, cap * sizeof(queueItem));
+      if (spill == NULL)
+        return false;
+      q->spill = spill;
+      q->spillCap = cap;
+    }
+  }
+  q->spill[q->spillHead + q->spillLen++] = *item;
+  return true;
+}
+
+void queueAdd(queue *q, findata *transaction) {
+  queueItem item = {*transaction, monotonicNs()};
+  long slot;
+
+  // The producer waits for room before it services the socket, but one
+  // message can carry more trades than there is room for. Those wait behind
+  // the ring, and are only lost when the spill list can not grow.
+  if (q->spillLen > 0 || !findataRingTryPush(&q->ring, &item, &slot)) {
+    if (spillPush(q, &item)) {
+      metricsAdd(&stats.queueSpilled, 1);
+    } else {
+      metricsAdd(&stats.queueDropped, 1);
+      findataFree(transaction);
+    }
+  }
+  metricsQueueDepth(q);
+
+  return;
+}
+
+void queueDel(queue *q) {
+  queueItem item;
+  long slot;
+
+  if (!findataRingTryPop(&q->ring, &item, &slot)) {
+    printf("\033[1mThere is nothing to delete. Queue empty. Aborting\033[0m\n");
+    return;
+  }
+  if (q->spillLen > 0) {
+    findataRingTryPush(&q->ring, &q->spill[q->spillHead], &slot);
+    q->spillHead = --q->spillLen > 0 ? q->spillHead + 1 : 0;
+  }
+  q->lastWaitNs = monotonicNs() - item.addedAt;
+  saveTransaction(&item.data);
+  metricsQueueDepth(q);
+
+  return;
+}
+
+void saveTransaction(findata *transaction) {
+  symbol *s = symbolLookup(transaction->symbol);
+  if (s == NULL) {
+    metricsAdd(&stats.droppedTrades, 1);
+    return;
+  }
+  // A trade whose price or volume does not fit is dropped before it is
+  // logged, so the log and the candlestick agree
+  if (!updateCandlestick(&s->c, transaction)) {
+    metricsAdd(&stats.parseFailures, 1);
+    return;
+  }
+  metricsAdd(&stats.trades[s - symbols], 1);
+
+  fprintf(s->transaction, "%s,%s,%s,%s,%llu\n", transaction->price,
+          transaction->symbol, transaction->timestamp, transaction->volume,
+          get_timestamp());
+}
+
+bool updateCandlestick(candlestickMinute *c, findata *transaction) {
+  fixed_t price, vol, totalPrice, totalVol;
+
+  if (!fixedFromString(transaction->price, &price) ||
+      !fixedFromString(transaction->volume, &vol) ||
+      __builtin_add_overflow(c->totalPrice, price, &totalPrice) ||
+      __builtin_add_overflow(c->vol, vol, &totalVol))
+    return false;
+
+  if (c->isDefault) {
+    c->open = price;
+    c->min = price;
+    c->max = price;
+  } else {
+    if (c->min > price) {
+      c->min = price;
+    }
+    if (c->max < price) {
+      c->max = price;
+    }
+  }
+
+  c->close = price;
+  c->numTransactions += 1;
+  c->totalPrice = totalPrice;
+  c->vol = totalVol;
+  c->isDefault = false;
+  return true;
+}
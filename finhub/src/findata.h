@@ -0,0 +1,135 @@
+#ifndef FINDATA_H
+#define FINDATA_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ring.h"
+
+#define MOVING_AVERAGE_TIMESPAN_MINUTES 15
+
+#define NUM_SYMBOLS 4
+
+// Prices and volumes are kept as fixed point decimals, the value multiplied by
+// FIXED_SCALE in an int64, so running sums are exact. They are converted to
+// double only when written out.
+typedef int64_t fixed_t;
+
+#define FIXED_DECIMALS 8
+#define FIXED_SCALE 100000000LL
+
+typedef struct {
+  char *price;
+  char *symbol;
+  char *timestamp;
+  char *volume;
+} findata;
+
+extern const findata DEFAULT_FINDATA;
+
+typedef struct {
+  findata data;
+  uint64_t addedAt; // monotonic ns the item was added
+} queueItem;
+
+// Only touched with the queue mutex held
+RING_DEFINE(findataRing, queueItem, 0, RING_LOCKED)
+
+// Trades that found the ring full wait in the spill list, in order, and move
+// into the ring as it drains, so the ring is full while the list is not empty
+typedef struct {
+  findataRing ring;
+  queueItem *spill;
+  long spillHead, spillLen, spillCap;
+  uint64_t lastWaitNs; // time the item removed last spent in the queue
+  long size;
+  pthread_cond_t *notFull, *notEmpty;
+} queue;
+
+static inline bool queueFull(queue *q) {
+  return findataRingLen(&q->ring) == q->size;
+}
+
+static inline long queueLen(queue *q) {
+  return findataRingLen(&q->ring) + q->spillLen;
+}
+
+static inline bool queueEmpty(queue *q) {
+  return findataRingLen(&q->ring) == 0;
+}
+
+typedef struct {
+  fixed_t open;
+  fixed_t close;
+  fixed_t max;
+  fixed_t min;
+  fixed_t vol;
+  fixed_t totalPrice;
+  uint64_t numTransactions;
+  bool isDefault;
+} candlestickMinute;
+
+typedef struct {
+  fixed_t prices[MOVING_AVERAGE_TIMESPAN_MINUTES];
+  fixed_t totalPrice;
+  uint8_t count;
+  uint8_t index;
+} movingAverage;
+
+// Per symbol state: the candlestick of the running minute, the moving average
+// and the csv logs
+typedef struct {
+  const char *name;    // finnhub trade symbol
+  const char *logName; // prefix of the log files
+  candlestickMinute c;
+  movingAverage ma;
+  FILE *transaction;
+  FILE *fp_ma;
+  FILE *fp_candlestick;
+} symbol;
+
+extern symbol symbols[NUM_SYMBOLS];
+
+// The JSON paths/labels that we are interested in
+extern const char *const tok[4];
+
+unsigned long long get_timestamp();
+
+bool fixedFromString(const char *s, fixed_t *out);
+double fixedToDouble(fixed_t x);
+uint64_t uintFromString(const char *s);
+
+void findataFromJson(findata *transaction, const char *label, char *buf);
+void findataFree(findata *transaction);
+
+queue *queueInit(long size);
+void queueDelete(queue *q);
+void queueAdd(queue *q, findata *in);
+void queueDel(queue *q);
+
+symbol *symbolLookup(const char *name);
+
+void candlestickInit(candlestickMinute *c);
+void candlestickMerge(candlestickMinute *c, candlestickMinute *later);
+void movingAverageInit(movingAverage *ma);
+/**
+ * Writes the candlestick of the minute that ended at endMs, ms since epoch,
+ * stamped with the time it is written
+ */
+void saveCandlestick(candlestickMinute *c, FILE *fp, uint64_t endMs);
+fixed_t getMean(candlestickMinute *c);
+/**
+ * Adds the trade to the candlestick. Returns false, leaving it as it was, if
+ * the price or the volume does not parse into or add up in a fixed_t.
+ */
+bool updateCandlestick(candlestickMinute *c, findata *transaction);
+void saveTransaction(findata *transaction);
+void saveMovingAverage(movingAverage *ma, FILE *fp);
+void addDataPoint(movingAverage *ma, fixed_t price);
+void transactionsHeader(FILE *fp);
+void candlesticksHeader(FILE *fp);
+void movingAverageHeader(FILE *fp);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Checks of the money parser, of the candlestick totals and of the rounding
+ * of the candlestick mean.
+ * Exits 1 when a check fails.
+ */
+#include <stdio.h>
+
+#include "findata.h"
+#include "metrics.h"
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond);        \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+// The value of s, or -1 when it does not parse
+static fixed_t parse(const char *s) {
+  fixed_t x;
+  return fixedFromString(s, &x) ? x : -1;
+}
+
+static void testParse() {
+  CHECK(parse("0") == 0);
+  CHECK(parse("123.45") == 12345000000LL);
+  CHECK(parse("+1.5") == 150000000);
+  CHECK(parse("-1.5") == -150000000);
+  CHECK(parse("-0.00000001") == -1);
+  CHECK(parse(".25") == 25000000);
+}
+
+// finnhub sends small crypto volumes with an exponent
+static void testExponent() {
+  CHECK(parse("1e-05") == 1000);
+  CHECK(parse("1e-5") == 1000);
+  CHECK(parse("2.5E-3") == 250000);
+  CHECK(parse("-1e-05") == -1000);
+  CHECK(parse("1.5e2") == 15000000000LL);
+  CHECK(parse("1e+2") == 10000000000LL);
+  CHECK(parse("1e-9") == 0);
+  CHECK(parse("1e-99999999999999999999") == 0);
+  CHECK(parse("0e99999999999999999999") == 0);
+  CHECK(parse("123456e-10") == 1234);
+}
+
+// Digits past FIXED_DECIMALS are dropped, not rounded, once the exponent is
+// applied
+static void testTruncation() {
+  CHECK(parse("0.123456789") == 12345678);
+  CHECK(parse("0.999999999999") == 99999999);
+  CHECK(parse("-0.000000019") == -1);
+  CHECK(parse("1.000000009e1") == 1000000009);
+  CHECK(parse("0.0000000000123456789e10") == 12345678);
+  CHECK(parse("99999999999999999999e-15") == 9999999999999LL);
+  CHECK(parse("0.00000000000000000000000000001e29") == 100000000);
+}
+
+// Values too large for fixed_t do not parse
+static void testOverflow() {
+  fixed_t x = 7;
+
+  CHECK(!fixedFromString("1e30", &x));
+  CHECK(!fixedFromString("-1e30", &x));
+  CHECK(!fixedFromString("92233720369", &x));
+  CHECK(!fixedFromString("99999999999999999999999999.5", &x));
+  CHECK(!fixedFromString("1e99999999999999999999", &x));
+  CHECK(x == 7);
+  CHECK(parse("92233720368") == 9223372036800000000LL);
+  CHECK(parse("922337203.68e2") == 9223372036800000000LL);
+}
+
+// A trade that does not parse, or would overflow the totals, is dropped
+static void testUpdate() {
+  candlestickMinute c;
+  findata t = {"92233720368", "AMZN", "0", "1"};
+
+  candlestickInit(&c);
+  CHECK(updateCandlestick(&c, &t));
+  CHECK(!updateCandlestick(&c, &t));
+  CHECK(c.numTransactions == 1 && c.totalPrice == 9223372036800000000LL);
+  t.price = "1";
+  t.volume = "1e30";
+  CHECK(!updateCandlestick(&c, &t));
+  CHECK(c.numTransactions == 1 && c.vol == FIXED_SCALE);
+  CHECK(c.close == 9223372036800000000LL);
+}
+
+static fixed_t mean(fixed_t totalPrice, uint64_t n) {
+  candlestickMinute c;
+  candlestickInit(&c);
+  c.totalPrice = totalPrice;
+  c.numTransactions = n;
+  return getMean(&c);
+}
+
+// The mean is rounded to the nearest unit, halves up
+static void testMean() {
+  CHECK(mean(0, 0) == 0);
+  CHECK(mean(10, 3) == 3);
+  CHECK(mean(11, 3) == 4);
+  CHECK(mean(5, 2) == 3);
+  CHECK(mean(4, 2) == 2);
+  CHECK(mean(3 * FIXED_SCALE, 3) == FIXED_SCALE);
+}
+
+int main() {
+  testParse();
+  testExponent();
+  testTruncation();
+  testOverflow();
+  testUpdate();
+  testMean();
+
+  printf("fixed: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,226 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+metrics stats;
+
+static pthread_t metricsThread;
+static atomic_bool metricsRunning;
+static int listenFd = -1;
+static int logEvery;
+
+// Per symbol trade rate over the last second, updated by the metrics thread
+static double tradesPerSecond[NUM_SYMBOLS];
+
+uint64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t load(atomic_uint_fast64_t *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static int render(char *buf, size_t len) {
+  int n = 0;
+
+#define METRIC(name, type, help)                                               \
+  n += snprintf(buf + n, len - n, "# HELP " name " " help "\n# TYPE " name       \
+                                  " " type "\n")
+
+  METRIC("finhub_trades_total", "counter", "Trades consumed per symbol.");
+  for (int i = 0; i < NUM_SYMBOLS; i++)
+    n += snprintf(buf + n, len - n,
+                  "finhub_trades_total{symbol=\"%s\"} %" PRIu64 "\n",
+                  symbols[i].name, load(&stats.trades[i]));
+  METRIC("finhub_trades_per_second", "gauge",
+         "Trades consumed per symbol during the last second.");
+  for (int i = 0; i < NUM_SYMBOLS; i++)
+    n += snprintf(buf + n, len - n,
+                  "finhub_trades_per_second{symbol=\"%s\"} %.0f\n",
+                  symbols[i].name, tradesPerSecond[i]);
+  METRIC("finhub_dropped_trades_total", "counter",
+         "Trades of symbols that are not tracked.");
+  n += snprintf(buf + n, len - n, "finhub_dropped_trades_total %" PRIu64 "\n",
+                load(&stats.droppedTrades));
+  METRIC("finhub_messages_total", "counter", "Websocket messages received.");
+  n += snprintf(buf + n, len - n, "finhub_messages_total %" PRIu64 "\n",
+                load(&stats.messages));
+  METRIC("finhub_parse_failures_total", "counter",
+         "Messages or fields that could not be parsed.");
+  n += snprintf(buf + n, len - n, "finhub_parse_failures_total %" PRIu64 "\n",
+                load(&stats.parseFailures));
+  METRIC("finhub_reconnects_total", "counter",
+         "Websocket connections opened after the first one.");
+  n += snprintf(buf + n, len - n, "finhub_reconnects_total %" PRIu64 "\n",
+                load(&stats.reconnects));
+  METRIC("finhub_queue_full_total", "counter",
+         "Times a producer found the queue full.");
+  n += snprintf(buf + n, len - n, "finhub_queue_full_total %" PRIu64 "\n",
+                load(&stats.queueFull));
+  METRIC("finhub_queue_spilled_total", "counter",
+         "Trades that found the queue full and waited behind it.");
+  n += snprintf(buf + n, len - n, "finhub_queue_spilled_total %" PRIu64 "\n",
+                load(&stats.queueSpilled));
+  METRIC("finhub_queue_dropped_total", "counter",
+         "Trades lost because the queue was full and could not grow.");
+  n += snprintf(buf + n, len - n, "finhub_queue_dropped_total %" PRIu64 "\n",
+                load(&stats.queueDropped));
+  METRIC("finhub_producer_blocked_seconds_total", "counter",
+         "Time producers spent waiting for room in the queue.");
+  n += snprintf(buf + n, len - n,
+                "finhub_producer_blocked_seconds_total %.6f\n",
+                load(&stats.producerBlockedNs) / 1e9);
+  METRIC("finhub_consumer_idle_seconds_total", "counter",
+         "Time consumers spent waiting for an item.");
+  n += snprintf(buf + n, len - n, "finhub_consumer_idle_seconds_total %.6f\n",
+                load(&stats.consumerIdleNs) / 1e9);
+  METRIC("finhub_queue_depth", "gauge", "Items in the queue.");
+  n += snprintf(buf + n, len - n, "finhub_queue_depth %ld\n",
+                atomic_load(&stats.queueDepth));
+  METRIC("finhub_queue_high_water", "gauge", "Highest queue depth seen.");
+  n += snprintf(buf + n, len - n, "finhub_queue_high_water %ld\n",
+                atomic_load(&stats.queueHighWater));
+  METRIC("finhub_queue_size", "gauge", "Capacity of the queue.");
+  n += snprintf(buf + n, len - n, "finhub_queue_size %ld\n",
+                atomic_load(&stats.queueSize));
+
+  METRIC("finhub_consumers_active", "gauge",
+         "Consumers of the pool that take items.");
+  n += snprintf(buf + n, len - n, "finhub_consumers_active %d\n",
+                atomic_load(&stats.activeConsumers));
+
+#undef METRIC
+  return n;
+}
+
+static void serve(int fd) {
+  char req[1024];
+  char body[8192];
+  char header[128];
+
+  // The request is not inspected, every path returns the metrics
+  struct pollfd p = {fd, POLLIN, 0};
+  if (poll(&p, 1, 100) > 0)
+    read(fd, req, sizeof(req));
+
+  int len = render(body, sizeof(body));
+  int hlen = snprintf(header, sizeof(header),
+                      "HTTP/1.0 200 OK\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %d\r\n\r\n",
+                      len);
+  write(fd, header, hlen);
+  write(fd, body, len);
+  close(fd);
+}
+
+static void logLine(uint64_t *lastBlocked, uint64_t *lastIdle) {
+  uint64_t blocked = load(&stats.producerBlockedNs);
+  uint64_t idle = load(&stats.consumerIdleNs);
+
+  fprintf(stderr, "[metrics] tps");
+  for (int i = 0; i < NUM_SYMBOLS; i++)
+    fprintf(stderr, " %s=%.0f", symbols[i].logName, tradesPerSecond[i]);
+  fprintf(stderr,
+          " q=%ld/%ld hwm=%ld cons=%d blocked=%.3fs idle=%.3fs reconn=%" PRIu64
+          " "
+          "parsefail=%" PRIu64 " drop=%" PRIu64 "\n",
+          atomic_load(&stats.queueDepth), atomic_load(&stats.queueSize),
+          atomic_load(&stats.queueHighWater),
+          atomic_load(&stats.activeConsumers), (blocked - *lastBlocked) / 1e9,
+          (idle - *lastIdle) / 1e9, load(&stats.reconnects),
+          load(&stats.parseFailures), load(&stats.droppedTrades));
+
+  *lastBlocked = blocked;
+  *lastIdle = idle;
+}
+
+static void *metricsLoop(void *args) {
+  uint64_t lastTrades[NUM_SYMBOLS] = {0};
+  uint64_t lastBlocked = 0, lastIdle = 0;
+  uint64_t lastTick = monotonicNs();
+  int seconds = 0;
+
+  while (atomic_load(&metricsRunning)) {
+    if (listenFd >= 0) {
+      struct pollfd p = {listenFd, POLLIN, 0};
+      if (poll(&p, 1, 200) > 0) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd >= 0)
+          serve(fd);
+      }
+    } else {
+      usleep(200000);
+    }
+
+    uint64_t now = monotonicNs();
+    if (now - lastTick < 1000000000ULL)
+      continue;
+    double elapsed = (now - lastTick) / 1e9;
+    lastTick = now;
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+      uint64_t trades = load(&stats.trades[i]);
+      tradesPerSecond[i] = (trades - lastTrades[i]) / elapsed;
+      lastTrades[i] = trades;
+    }
+    if (logEvery && ++seconds % logEvery == 0)
+      logLine(&lastBlocked, &lastIdle);
+  }
+  return (NULL);
+}
+
+int metricsStart(int port, int logInterval) {
+  logEvery = logInterval;
+
+  if (port) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+      perror("metrics: socket");
+      return -1;
+    }
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listenFd, 8) < 0) {
+      perror("metrics: bind");
+      close(listenFd);
+      listenFd = -1;
+      return -1;
+    }
+  }
+
+  atomic_store(&metricsRunning, true);
+  if (pthread_create(&metricsThread, NULL, metricsLoop, NULL)) {
+    atomic_store(&metricsRunning, false);
+    return -1;
+  }
+  return 0;
+}
+
+void metricsStop() {
+  if (!atomic_load(&metricsRunning))
+    return;
+  atomic_store(&metricsRunning, false);
+  pthread_join(metricsThread, NULL);
+  if (listenFd >= 0)
+    close(listenFd);
+  listenFd = -1;
+}
@@ -0,0 +1,50 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "findata.h"
+
+// Lock-free counters and gauges of the client. Hot paths only do relaxed
+// atomic adds; the metrics thread reads them to serve the prometheus endpoint
+// and to print the periodic stderr line.
+typedef struct {
+  atomic_uint_fast64_t trades[NUM_SYMBOLS];
+  atomic_uint_fast64_t droppedTrades; // trades of a symbol we do not track
+  atomic_uint_fast64_t messages;
+  atomic_uint_fast64_t parseFailures;
+  atomic_uint_fast64_t reconnects;
+  atomic_uint_fast64_t queueFull;
+  atomic_uint_fast64_t queueSpilled; // trades added behind a full ring
+  atomic_uint_fast64_t queueDropped; // trades lost when the spill can not grow
+  atomic_uint_fast64_t producerBlockedNs;
+  atomic_uint_fast64_t consumerIdleNs;
+  atomic_long queueDepth;
+  atomic_long queueHighWater;
+  atomic_long queueSize;
+  atomic_int activeConsumers;
+} metrics;
+
+extern metrics stats;
+
+static inline void metricsAdd(atomic_uint_fast64_t *counter, uint64_t n) {
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+// Called with the queue mutex held, after every add and del
+static inline void metricsQueueDepth(queue *q) {
+  long depth = queueLen(q);
+  atomic_store_explicit(&stats.queueDepth, depth, memory_order_relaxed);
+  if (depth > atomic_load_explicit(&stats.queueHighWater, memory_order_relaxed))
+    atomic_store_explicit(&stats.queueHighWater, depth, memory_order_relaxed);
+}
+
+uint64_t monotonicNs();
+
+// Starts the metrics thread. port == 0 disables the http endpoint and
+// logInterval == 0 disables the stderr line.
+int metricsStart(int port, int logInterval);
+void metricsStop();
+
+#endif
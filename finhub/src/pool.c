@@ -0,0 +1,124 @@
+#include "pool.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+static atomic_int active;
+static atomic_bool finished;
+static int minActive, maxActive;
+
+static atomic_uint activeSeq; // bumped when the active count changes
+static atomic_uint itemsSeq;  // bumped when items may have been added
+static atomic_int itemWaiters;
+
+static atomic_uint_fast64_t waitEwmaNs;
+
+static void futexWait(atomic_uint *addr, unsigned val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futexWake(atomic_uint *addr, int n) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+void poolInit(int minConsumers, int maxConsumers) {
+  minActive = minConsumers;
+  maxActive = maxConsumers;
+  atomic_store(&active, minConsumers);
+  atomic_store(&finished, false);
+  atomic_store(&stats.activeConsumers, minConsumers);
+}
+
+bool poolPark(int id) {
+  while (!atomic_load(&finished)) {
+    unsigned seq = atomic_load(&activeSeq);
+    if (id < atomic_load(&active))
+      return true;
+    futexWait(&activeSeq, seq);
+  }
+  return false;
+}
+
+unsigned poolItemsSeq() { return atomic_load(&itemsSeq); }
+
+void poolWaitItems(unsigned seq) {
+  atomic_fetch_add(&itemWaiters, 1);
+  if (!atomic_load(&finished))
+    futexWait(&itemsSeq, seq);
+  atomic_fetch_sub(&itemWaiters, 1);
+}
+
+void poolNotify() {
+  atomic_fetch_add(&itemsSeq, 1);
+  if (atomic_load(&itemWaiters) > 0)
+    futexWake(&itemsSeq, 1);
+}
+
+void poolObserve(uint64_t waitNs) {
+  uint64_t ewma = atomic_load_explicit(&waitEwmaNs, memory_order_relaxed);
+  ewma = ewma - ewma / 8 + waitNs / 8;
+  atomic_store_explicit(&waitEwmaNs, ewma, memory_order_relaxed);
+}
+
+static void setActive(int n) {
+  atomic_store(&active, n);
+  atomic_store(&stats.activeConsumers, n);
+  atomic_fetch_add(&activeSeq, 1);
+  futexWake(&activeSeq, INT_MAX);
+  // Consumers that are no longer active re-check and park
+  atomic_fetch_add(&itemsSeq, 1);
+  futexWake(&itemsSeq, INT_MAX);
+}
+
+void *poolController(void *args) {
+  int busy = 0, quiet = 0;
+
+  while (!atomic_load(&finished)) {
+    usleep(POOL_TICK_MS * 1000);
+
+    long size = atomic_load(&stats.queueSize);
+    double occupancy =
+        size ? (double)atomic_load(&stats.queueDepth) / size : 0;
+    uint64_t wait = atomic_load_explicit(&waitEwmaNs, memory_order_relaxed);
+    // Nothing is dequeued while the queue is empty, so let the wait decay
+    if (atomic_load(&stats.queueDepth) == 0) {
+      wait /= 2;
+      atomic_store_explicit(&waitEwmaNs, wait, memory_order_relaxed);
+    }
+
+    if (occupancy >= POOL_GROW_OCCUPANCY || wait >= POOL_GROW_WAIT_NS) {
+      busy++;
+      quiet = 0;
+    } else if (occupancy <= POOL_SHRINK_OCCUPANCY &&
+               wait <= POOL_SHRINK_WAIT_NS) {
+      quiet++;
+      busy = 0;
+    } else {
+      busy = quiet = 0;
+    }
+
+    int n = atomic_load(&active);
+    if (busy >= POOL_GROW_TICKS && n < maxActive) {
+      setActive(n + 1);
+      busy = 0;
+    } else if (quiet >= POOL_SHRINK_TICKS && n > minActive) {
+      setActive(n - 1);
+      quiet = 0;
+    }
+  }
+  return (NULL);
+}
+
+void poolShutdown() {
+  atomic_store(&finished, true);
+  atomic_fetch_add(&activeSeq, 1);
+  futexWake(&activeSeq, INT_MAX);
+  atomic_fetch_add(&itemsSeq, 1);
+  futexWake(&itemsSeq, INT_MAX);
+}
@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "findata.h"
+
+#define POOL_MAX_CONSUMERS 8
+#define POOL_MIN_DEFAULT 1
+#define POOL_MAX_DEFAULT 4
+
+// Every POOL_TICK_MS the controller looks at the queue occupancy and at the
+// time items wait in the queue. It grows the pool after POOL_GROW_TICKS busy
+// ticks in a row and shrinks it after POOL_SHRINK_TICKS quiet ones, so a short
+// burst or lull does not make it flap.
+#define POOL_TICK_MS 100
+#define POOL_GROW_TICKS 3
+#define POOL_SHRINK_TICKS 50
+#define POOL_GROW_OCCUPANCY 0.5
+#define POOL_SHRINK_OCCUPANCY 0.1
+#define POOL_GROW_WAIT_NS 20000000ULL  // 20 ms
+#define POOL_SHRINK_WAIT_NS 2000000ULL // 2 ms
+
+// Consumers with an id below the active count take items; the others are
+// parked on a futex until the controller raises the count. Idle active
+// consumers wait on a second futex that producers bump after adding items, and
+// producers skip the wake syscall when nobody waits.
+void poolInit(int minConsumers, int maxConsumers);
+
+// Blocks while consumer id is parked. Returns false once the pool shuts down.
+bool poolPark(int id);
+
+// Sequence to read under the queue mutex before waiting for items
+unsigned poolItemsSeq();
+
+// Waits until items are added after seq was read, or the pool shuts down
+void poolWaitItems(unsigned seq);
+
+// Called by producers after they added items
+void poolNotify();
+
+// Records how long the item just removed waited in the queue
+void poolObserve(uint64_t waitNs);
+
+// Runs the sizing loop until poolShutdown
+void *poolController(void *args);
+
+// Wakes every consumer, parked or idle, to drain the queue and exit
+void poolShutdown();
+
+#endif
@@ -0,0 +1,96 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC 0x46484253 // "FHBS"
+#define SNAPSHOT_VERSION 1
+
+// FNV-1a over everything but the checksum itself
+static uint64_t checksum(const snapshot *s) {
+  const unsigned char *p = (const unsigned char *)s;
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < offsetof(snapshot, checksum); i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void snapshotTake(snapshot *s, uint64_t candleStart,
+                  uint64_t minutesSinceStart) {
+  memset(s, 0, sizeof(*s));
+  s->magic = SNAPSHOT_MAGIC;
+  s->version = SNAPSHOT_VERSION;
+  s->savedAt = get_timestamp();
+  s->candleStart = candleStart;
+  s->minutesSinceStart = minutesSinceStart;
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    strncpy(s->symbols[i].name, symbols[i].name,
+            sizeof(s->symbols[i].name) - 1);
+    s->symbols[i].c = symbols[i].c;
+    s->symbols[i].ma = symbols[i].ma;
+  }
+  s->checksum = checksum(s);
+}
+
+int snapshotSave(const snapshot *s, const char *path) {
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("snapshot: open");
+    return -1;
+  }
+  if (write(fd, s, sizeof(*s)) != sizeof(*s) || fsync(fd) < 0) {
+    perror("snapshot: write");
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+  close(fd);
+
+  if (rename(tmp, path) < 0) {
+    perror("snapshot: rename");
+    unlink(tmp);
+    return -1;
+  }
+
+  // Make the rename itself durable
+  char dir[256];
+  snprintf(dir, sizeof(dir), "%s", path);
+  int dirFd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+  if (dirFd >= 0) {
+    fsync(dirFd);
+    close(dirFd);
+  }
+  return 0;
+}
+
+int snapshotLoad(snapshot *s, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  ssize_t n = read(fd, s, sizeof(*s));
+  close(fd);
+
+  if (n != sizeof(*s) || s->magic != SNAPSHOT_MAGIC ||
+      s->version != SNAPSHOT_VERSION || s->checksum != checksum(s)) {
+    fprintf(stderr, "snapshot: %s is not a valid snapshot, ignoring it.\n",
+            path);
+    return -1;
+  }
+  for (int i = 0; i < NUM_SYMBOLS; i++) {
+    if (strcmp(s->symbols[i].name, symbols[i].name) != 0) {
+      fprintf(stderr, "snapshot: %s has different symbols, ignoring it.\n",
+              path);
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "findata.h"
+
+#define SNAPSHOT_PATH "finhub_state.bin"
+#define SNAPSHOT_INTERVAL_SECONDS 10
+
+// State of the client that is needed for a warm restart: the running
+// candlestick and the moving average window of every symbol
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t savedAt;     // ms since epoch
+  uint64_t candleStart; // ms since epoch when the running minute started
+  uint64_t minutesSinceStart;
+  struct {
+    char name[32];
+    candlestickMinute c;
+    movingAverage ma;
+  } symbols[NUM_SYMBOLS];
+  uint64_t checksum;
+} snapshot;
+
+// Copies the state of the symbols table. Called with the mutex held.
+void snapshotTake(snapshot *s, uint64_t candleStart,
+                  uint64_t minutesSinceStart);
+
+// Writes to a temp file and renames it over path, so a crash leaves either the
+// previous or the new snapshot on disk, never a torn one
+int snapshotSave(const snapshot *s, const char *path);
+
+// Returns 0 if path holds a valid snapshot of the same symbols
+int snapshotLoad(snapshot *s, const char *path);
+
+#endif
@@ -1,16 +1,100 @@
 #!/bin/bash
 
-queuesize=(20 50 200 1000)
+queuesize=20,50,200,1000
 loop=2000
-producers=(1 2 4)
-consumers=(1 2 4)
-
-echo "queuesize,loopsize,producers,consumers,time,item" > results.csv
-for i in ${queuesize[@]}; do
-    make local QUEUESIZE=$i
-    for j in ${producers[@]}; do 
-        for k in ${consumers[@]}; do
-            ./bin/local $loop $j $k 
-        done
-    done
-done
\ No newline at end of file
+producers=1,2,4
+consumers=1,2,4
+backends=locked,mpmc,ticket,segmented,lanes
+threads=1,2,4,8,16
+waits=spin,yield,futex,cond
+
+make local
+
+echo "queuesize,loopsize,producers,consumers,time,item,backend,wait,lateness" > results.csv
+echo "queuesize,loopsize,producers,consumers,backend,items,time,itemspersec,wait,cputime,burst,pauseus,deadline,misses,payload,allocator,shards,reordered,kernel,cost,batch" > throughput.csv
+echo "queuesize,producers,consumers,backend,wait,producer,period,activation,jitter" > jitter.csv
+echo "queuesize,loopsize,producers,consumers,backend,wait,lock,hog,role,priority,ops,blocked,mean,p99,max" > blocking.csv
+./bin/local -q $backends -Q $queuesize $loop $producers $consumers
+
+# scaling of every backend with as many consumers as producers
+for t in ${threads//,/ }; do
+    ./bin/local -q $backends -Q 200 $loop $t $t
+done
+
+# handoff latency against cpu time of every wait strategy
+./bin/local -q locked,mpmc,ticket,segmented -w $waits -Q 200 $loop $producers $consumers
+
+# one row of statistics per configuration over 5 pinned repetitions
+./bin/local -q $backends -w $waits -Q $queuesize -W 1 -r 5 -c -o summary.csv \
+    $loop $producers $consumers
+
+# bursts larger than the bounded rings, against a segmented queue that can
+# hold a whole burst of every producer
+./bin/local -q locked,mpmc,ticket -Q 200 -b 100,1000,5000 -p 5000 -r 5 \
+    -o bursts_bounded.csv 20000 $producers $consumers
+./bin/local -q segmented -Q 100000 -b 100,1000,5000 -p 5000 -r 5 \
+    -o bursts_segmented.csv 20000 $producers $consumers
+
+# deadline misses and lateness of earliest deadline first against FIFO when
+# the producers outrun the consumers
+for d in 200 1000 5000; do
+    ./bin/local -q locked,edf -Q 200,1000 -D $d -r 5 \
+        -o deadlines_$d.csv 20000 4 1,2
+done
+
+# periodic producers at 10 ms, 100 ms and 1 s for ten minutes: activation
+# jitter and queue wait per backend
+./bin/local -q locked,mpmc,segmented -w futex,cond -P 10000,100000,1000000 \
+    -S 100000 -o periodic.csv 600 3 1,2
+
+# thousands of logical consumers as fibers on a few pinned threads against one
+# thread per consumer
+./bin/local -q locked,mpmc,segmented -Q 200 -r 5 -o consumers_threads.csv \
+    20000 4 1000,2000,5000,10000
+for f in 1 2 4; do
+    ./bin/local -q locked,mpmc,segmented -Q 200 -F $f -c -r 5 \
+        -o consumers_fibers_$f.csv 20000 4 1000,2000,5000,10000
+done
+
+# priority inversion: a high and a low priority producer class on one pinned
+# cpu with a medium priority hog, under every mutex protocol (needs root)
+./bin/local -q locked,edf -L plain,inherit,protect -R 80,10 -K 50 -H 60 -c \
+    -Q 20 -r 5 -o inversion.csv 20000 2 2
+
+# small and medium payloads that producers allocate and consumers free, from
+# malloc against the pool of the queue, at 1 to 16 threads per side
+for t in ${threads//,/ }; do
+    ./bin/local -q mpmc,segmented -Q 200 -A 64,1024 -M malloc,pool -r 5 \
+        -o payloads_$t.csv 20000 $t $t
+done
+
+# one queue against K shards with two random choices: throughput scaling and
+# ordering skew as K and the thread counts grow
+for t in ${threads//,/ }; do
+    ./bin/local -q locked,mpmc -Q 200 -r 5 -o shards_0_$t.csv 20000 $t $t
+    ./bin/local -q locked,mpmc -Q 200 -s 1,2,4,8,16 -r 5 \
+        -o shards_$t.csv 20000 $t $t
+done
+
+# queue overhead against the grain of the work: every kernel from a few ns to
+# tens of us per item
+./bin/local -q locked,mpmc,segmented -Q 200 -k compute -C 1,10,100,1000,10000 \
+    -r 5 -o work_compute.csv 20000 $producers $consumers
+./bin/local -q locked,mpmc,segmented -Q 200 -k stream,chase,syscall \
+    -C 1,10,100,1000 -r 5 -o work_memory.csv 20000 $producers $consumers
+./bin/local -q locked,mpmc,segmented -Q 200 -k sleep -C 1,10,100 -r 5 \
+    -o work_sleep.csv 2000 $producers $consumers
+
+# one item against batches of up to B per queue operation: fewer lock and CAS
+# round trips for items that wait longer in the producer and consumer
+for t in ${threads//,/ }; do
+    ./bin/local -q locked,mpmc,ticket -Q 256 -B 1,4,16,64,256 -C 1,100 -r 5 \
+        -o batch_$t.csv 20000 $t $t
+done
+
+# the locked queue between threads of one process against the same ring in
+# shared memory between producer and consumer processes, and the shm queue
+# with every process killed once and restarted
+./bin/local -q locked,shm -Q 20,200 -r 5 -o processes.csv 20000 1,2,4 1,2,4
+./bin/local -q shm -Q 20,200 -X 1000 -r 5 -o processes_crash.csv \
+    20000 1,2,4 1,2,4
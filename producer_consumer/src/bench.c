@@ -0,0 +1,148 @@
+/*
+ * Task throughput and per task overhead of the executor.
+ *
+ * For every number of workers, task size and batch size the tasks are
+ * submitted a batch at a time and the submitter waits on the futures of the
+ * batch before the next one, so a batch of 1 is a full round trip per task.
+ * The overhead per task is the time of the busy workers, at most one per cpu,
+ * beyond running the same task inline.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "executor.h"
+
+#define MAX_SWEEP 16
+
+typedef struct {
+  long values[MAX_SWEEP];
+  int n;
+} sweep;
+
+// The size of a task is the number of sin() it computes
+static void *task(void *arg) {
+  long n = (long)arg;
+  double count = 0;
+  for (long i = 0; i < n; i++)
+    count += sin(i);
+  return count > 0 ? arg : NULL;
+}
+
+static void parseSweep(sweep *s, char *arg) {
+  s->n = 0;
+  for (char *t = strtok(arg, ","); t != NULL && s->n < MAX_SWEEP;
+       t = strtok(NULL, ","))
+    s->values[s->n++] = atol(t);
+}
+
+// Keeps the inline tasks from being optimized out
+static void *volatile sink;
+
+// ns per task when it runs inline
+static double inlineNs(long size, long tasks) {
+  uint64_t start = monotonicNs();
+  for (long i = 0; i < tasks; i++)
+    sink = task((void *)size);
+  return (double)(monotonicNs() - start) / tasks;
+}
+
+static double run(executor *e, long size, long batch, long tasks) {
+  workFunction *batchTasks =
+      (workFunction *)malloc(batch * sizeof(workFunction));
+  future *futures = (future *)malloc(batch * sizeof(future));
+  uint64_t start = monotonicNs();
+
+  for (long done = 0; done < tasks; done += batch) {
+    int n = tasks - done < batch ? tasks - done : batch;
+    for (int i = 0; i < n; i++)
+      batchTasks[i] = (workFunction){task, (void *)size, 0, 0, &futures[i]};
+    executorSubmitBatch(e, batchTasks, n);
+    futureWaitAll(futures, n);
+  }
+
+  uint64_t ns = monotonicNs() - start;
+  free(batchTasks);
+  free(futures);
+  return ns;
+}
+
+static void usage() {
+  printf("USAGE: ./bin/bench [-q locked|mpmc|ticket] [-w spin|yield|futex|cond]"
+         " [-n tasks] [-t 1,2,4] [-s 0,10,100,1000] [-b 1,16,64]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int backend = QUEUE_LOCKED;
+  int wait = -1;
+  long tasks = 100000;
+  char workersArg[] = "1,2,4", sizesArg[] = "0,10,100,1000",
+       batchesArg[] = "1,16,64";
+  sweep workers, sizes, batches;
+  parseSweep(&workers, workersArg);
+  parseSweep(&sizes, sizesArg);
+  parseSweep(&batches, batchesArg);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "q:w:n:t:s:b:")) != -1) {
+    switch (opt) {
+    case 'q':
+      if ((backend = queueBackendByName(optarg)) < 0)
+        usage();
+      break;
+    case 'w':
+      if ((wait = waitByName(optarg)) < 0)
+        usage();
+      break;
+    case 'n':
+      tasks = atol(optarg);
+      break;
+    case 't':
+      parseSweep(&workers, optarg);
+      break;
+    case 's':
+      parseSweep(&sizes, optarg);
+      break;
+    case 'b':
+      parseSweep(&batches, optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (wait < 0)
+    wait = queueBackends[backend]->defaultWait;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  printf("backend,wait,workers,tasksize,batch,tasks,time,taskspersec,"
+         "inlinens,overheadns\n");
+  for (int w = 0; w < workers.n; w++) {
+    int numWorkers = workers.values[w];
+    executor *e = executorInit(backend, QUEUESIZE, wait, numWorkers);
+    if (e == NULL) {
+      fprintf(stderr, "bench: executor init failed\n");
+      exit(1);
+    }
+    for (int s = 0; s < sizes.n; s++) {
+      double taskNs = inlineNs(sizes.values[s], tasks / 10 + 1);
+      for (int b = 0; b < batches.n; b++) {
+        long batch = batches.values[b];
+        run(e, sizes.values[s], batch, tasks / 10 + 1); // warm-up
+        double ns = run(e, sizes.values[s], batch, tasks);
+        long busy = numWorkers < cpus ? numWorkers : cpus;
+        printf("%s,%s,%d,%ld,%ld,%ld,%f,%f,%f,%f\n",
+               queueBackends[backend]->name, waitNames[wait], numWorkers,
+               sizes.values[s], batch, tasks, ns / 1e6, tasks / (ns / 1e9),
+               taskNs, ns * busy / tasks - taskNs);
+      }
+    }
+    executorShutdown(e);
+  }
+
+  return 0;
+}
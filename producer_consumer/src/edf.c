@@ -0,0 +1,118 @@
+/*
+ * Earliest deadline first queue: a binary min-heap on the deadline of the
+ * items behind one mutex. Items without a deadline sort after every item with
+ * one, and equal deadlines leave in the order they came in, so a heap of items
+ * without deadlines is a FIFO.
+ *
+ * An item is released when its producer adds it, so everything in the heap is
+ * ready to run and the root is always the next one to take.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+typedef struct {
+  uint64_t key; // deadline, UINT64_MAX for none
+  uint64_t seq; // ties go to the older item
+  workFunction data;
+} edfEntry;
+
+typedef struct {
+  pthread_mutex_t mut CACHE_ALIGNED;
+  long len CACHE_ALIGNED;
+  long size;
+  uint64_t seq;
+  edfEntry *heap;
+} edfHeap;
+
+static inline bool edfBefore(edfEntry *a, edfEntry *b) {
+  return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static inline void edfSwap(edfEntry *a, edfEntry *b) {
+  edfEntry t = *a;
+  *a = *b;
+  *b = t;
+}
+
+static void *edfInit(long size, lockProtocol lock) {
+  edfHeap *h = (edfHeap *)cacheAlloc(sizeof(edfHeap));
+  if (h == NULL)
+    return (NULL);
+  h->heap = (edfEntry *)malloc(size * sizeof(edfEntry));
+  if (h->heap == NULL) {
+    free(h);
+    return (NULL);
+  }
+  if (mutexInit(&h->mut, lock) != 0) {
+    free(h->heap);
+    free(h);
+    return (NULL);
+  }
+  h->size = size;
+  return h;
+}
+
+static void edfDestroy(void *impl) {
+  edfHeap *h = (edfHeap *)impl;
+  pthread_mutex_destroy(&h->mut);
+  free(h->heap);
+  free(h);
+}
+
+// The slot is where the item settled in the heap
+static bool edfTryAdd(queue *q, workFunction *in, long *slot) {
+  edfHeap *h = (edfHeap *)q->impl;
+  mutexLock(&h->mut);
+  if (h->len == h->size) {
+    mutexUnlock(&h->mut);
+    return false;
+  }
+
+  long i = h->len++;
+  h->heap[i].key = in->deadlineNs ? in->deadlineNs : UINT64_MAX;
+  h->heap[i].seq = h->seq++;
+  h->heap[i].data = *in;
+  h->heap[i].data.enqueuedNs = monotonicNs();
+  while (i > 0 && edfBefore(&h->heap[i], &h->heap[(i - 1) / 2])) {
+    edfSwap(&h->heap[i], &h->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  *slot = i;
+  mutexUnlock(&h->mut);
+  return true;
+}
+
+static bool edfTryDel(queue *q, workFunction *out, long *slot) {
+  edfHeap *h = (edfHeap *)q->impl;
+  mutexLock(&h->mut);
+  if (h->len == 0) {
+    mutexUnlock(&h->mut);
+    return false;
+  }
+
+  *out = h->heap[0].data;
+  h->heap[0] = h->heap[--h->len];
+  for (long i = 0;;) {
+    long min = i, l = 2 * i + 1, r = l + 1;
+    if (l < h->len && edfBefore(&h->heap[l], &h->heap[min]))
+      min = l;
+    if (r < h->len && edfBefore(&h->heap[r], &h->heap[min]))
+      min = r;
+    if (min == i)
+      break;
+    edfSwap(&h->heap[i], &h->heap[min]);
+    i = min;
+  }
+  *slot = 0;
+  mutexUnlock(&h->mut);
+  return true;
+}
+
+const queueOps edfOps = {.name = "edf",
+                         .defaultWait = WAIT_COND,
+                         .init = edfInit,
+                         .destroy = edfDestroy,
+                         .tryAdd = edfTryAdd,
+                         .tryDel = edfTryDel};
@@ -0,0 +1,112 @@
+#include "executor.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void futureComplete(future *f, void *result) {
+  f->result = result;
+  if (atomic_exchange(&f->state, FUTURE_DONE) == FUTURE_WAITED)
+    futexWake(&f->state, INT_MAX);
+}
+
+static void *worker(void *args) {
+  executor *e = (executor *)args;
+  workFunction task;
+
+  while (queueDel(e->q, &task) >= 0) {
+    void *result = (task.work)(task.arg);
+    if (task.future != NULL)
+      futureComplete(task.future, result);
+  }
+
+  return (NULL);
+}
+
+executor *executorInit(queueBackend backend, long size, int wait,
+                       int numWorkers) {
+  executor *e;
+
+  e = (executor *)malloc(sizeof(executor));
+  if (e == NULL)
+    return (NULL);
+
+  e->q = queueInit(backend, size, wait);
+  e->workers = (pthread_t *)malloc(numWorkers * sizeof(pthread_t));
+  if (e->q == NULL || e->workers == NULL) {
+    if (e->q != NULL)
+      queueDelete(e->q);
+    free(e->workers);
+    free(e);
+    return (NULL);
+  }
+
+  e->numWorkers = 0;
+  for (int i = 0; i < numWorkers; i++) {
+    int rc = pthread_create(&e->workers[i], NULL, worker, e);
+    if (rc) {
+      printf("Error creating threads %d\n", rc);
+      break;
+    }
+    e->numWorkers++;
+  }
+  if (e->numWorkers == 0) {
+    executorShutdown(e);
+    return (NULL);
+  }
+
+  return (e);
+}
+
+void executorSubmit(executor *e, void *(*work)(void *), void *arg, future *f) {
+  workFunction task = {.work = work, .arg = arg, .future = f};
+  if (f != NULL)
+    atomic_store_explicit(&f->state, FUTURE_PENDING, memory_order_relaxed);
+  queueAdd(e->q, &task);
+}
+
+void executorSubmitBatch(executor *e, workFunction *tasks, int n) {
+  for (int i = 0; i < n; i++) {
+    if (tasks[i].future != NULL)
+      atomic_store_explicit(&tasks[i].future->state, FUTURE_PENDING,
+                            memory_order_relaxed);
+  }
+  for (int i = 0; i < n; i++)
+    queueAdd(e->q, &tasks[i]);
+}
+
+void executorShutdown(executor *e) {
+  queueClose(e->q);
+  for (int i = 0; i < e->numWorkers; i++)
+    pthread_join(e->workers[i], NULL);
+  queueDelete(e->q);
+  free(e->workers);
+  free(e);
+}
+
+bool futureDone(future *f) {
+  return atomic_load_explicit(&f->state, memory_order_acquire) == FUTURE_DONE;
+}
+
+void *futureGet(future *f) {
+  int spins = 0;
+  unsigned state;
+
+  // Short tasks are usually done before a sleep would pay off
+  while (!futureDone(f) && ++spins < SPIN_LIMIT)
+    cpuRelax();
+
+  while ((state = atomic_load(&f->state)) != FUTURE_DONE) {
+    if (state == FUTURE_PENDING &&
+        !atomic_compare_exchange_strong(&f->state, &state, FUTURE_WAITED))
+      continue;
+    futexWait(&f->state, FUTURE_WAITED);
+  }
+
+  return f->result;
+}
+
+void futureWaitAll(future *f, int n) {
+  for (int i = 0; i < n; i++)
+    futureGet(&f[i]);
+}
@@ -0,0 +1,62 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+
+#include "queue.h"
+
+/**
+ * Completion handle of one task. The submitter owns the memory, so a task
+ * costs no allocation.
+ */
+typedef struct future {
+  void *result;
+  atomic_uint state; // FUTURE_PENDING, FUTURE_WAITED or FUTURE_DONE
+} future;
+
+#define FUTURE_PENDING 0
+#define FUTURE_WAITED 1 // pending and someone sleeps on it
+#define FUTURE_DONE 2
+
+/**
+ * A fixed pool of workers that take tasks from one queue of any backend and
+ * run work(arg)
+ */
+typedef struct {
+  queue *q;
+  pthread_t *workers;
+  int numWorkers;
+} executor;
+
+executor *executorInit(queueBackend backend, long size, int wait,
+                       int numWorkers);
+
+/**
+ * Blocks while the queue is full. f may be NULL when nobody waits for the
+ * result.
+ */
+void executorSubmit(executor *e, void *(*work)(void *), void *arg, future *f);
+
+/**
+ * Submits tasks[0..n), each completing its own future if it has one
+ */
+void executorSubmitBatch(executor *e, workFunction *tasks, int n);
+
+/**
+ * Runs the tasks that are still queued, then stops and frees the workers
+ */
+void executorShutdown(executor *e);
+
+bool futureDone(future *f);
+
+/**
+ * Blocks until the task is done and returns what work returned
+ */
+void *futureGet(future *f);
+
+/**
+ * Blocks until all n tasks are done
+ */
+void futureWaitAll(future *f, int n);
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * Fibers start on their own stack with makecontext/setcontext and from then
+ * on switch with _setjmp/_longjmp, which unlike swapcontext do not save and
+ * restore the signal mask, so a switch is a few register moves and no
+ * syscall. Every worker thread has a context of its own that a fiber jumps
+ * back to when it parks or returns.
+ */
+#define _GNU_SOURCE
+
+// The checked longjmp takes a jump to another stack for a corrupt one
+#undef _FORTIFY_SOURCE
+
+#include "fiber.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  jmp_buf ctx; // the worker loop, while a fiber runs
+  fiber *current;
+  // What the fiber that just switched out parks on
+  fiberWaitList *parkOn;
+  bool (*ready)(void *);
+  void *readyArg;
+} fiberThread;
+
+static _Thread_local fiberThread self;
+
+// A fiber may come back on another worker, so the address of self must be
+// looked up again after every switch instead of being kept in a register
+static __attribute__((noinline)) fiberThread *thisThread() { return &self; }
+
+static void lock(fiberWaitList *wl) {
+  while (atomic_flag_test_and_set_explicit(&wl->lock, memory_order_acquire))
+    cpuRelax();
+}
+
+static void unlock(fiberWaitList *wl) {
+  atomic_flag_clear_explicit(&wl->lock, memory_order_release);
+}
+
+// The run queue has room for every fiber and holds each one at most once
+static void makeReady(fiber *f) {
+  workFunction w = {.arg = f};
+  long slot;
+  while (!queueTryAdd(f->sched->ready, &w, &slot))
+    cpuRelax();
+}
+
+static void fiberMain() {
+  fiber *f = thisThread()->current;
+  f->fn(f->arg);
+  f->done = true;
+  _longjmp(thisThread()->ctx, 1);
+}
+
+fiberScheduler *fiberSchedulerInit(int numWorkers, int maxFibers, bool pin) {
+  fiberScheduler *s;
+
+  s = (fiberScheduler *)malloc(sizeof(fiberScheduler));
+  if (s == NULL)
+    return (NULL);
+
+  s->ready = queueInit(QUEUE_MPMC, maxFibers < 2 ? 2 : maxFibers, WAIT_SPIN);
+  s->fibers = (fiber **)malloc(maxFibers * sizeof(fiber *));
+  s->workers = (pthread_t *)malloc(numWorkers * sizeof(pthread_t));
+  if (s->ready == NULL || s->fibers == NULL || s->workers == NULL) {
+    if (s->ready != NULL)
+      queueDelete(s->ready);
+    free(s->fibers);
+    free(s->workers);
+    free(s);
+    return (NULL);
+  }
+  s->numFibers = 0;
+  s->maxFibers = maxFibers;
+  atomic_init(&s->live, 0);
+  s->numWorkers = numWorkers;
+  s->pin = pin;
+
+  return (s);
+}
+
+void fiberSchedulerDelete(fiberScheduler *s) {
+  for (int i = 0; i < s->numFibers; i++) {
+    free(s->fibers[i]->stack);
+    free(s->fibers[i]);
+  }
+  queueDelete(s->ready);
+  free(s->fibers);
+  free(s->workers);
+  free(s);
+}
+
+bool fiberSpawn(fiberScheduler *s, void *(*fn)(void *), void *arg) {
+  if (s->numFibers == s->maxFibers)
+    return false;
+
+  fiber *f = (fiber *)calloc(1, sizeof(fiber));
+  if (f == NULL)
+    return false;
+  f->stack = (char *)malloc(FIBER_STACK);
+  if (f->stack == NULL) {
+    free(f);
+    return false;
+  }
+  getcontext(&f->start);
+  f->start.uc_stack.ss_sp = f->stack;
+  f->start.uc_stack.ss_size = FIBER_STACK;
+  f->start.uc_link = NULL;
+  makecontext(&f->start, fiberMain, 0);
+  f->fn = fn;
+  f->arg = arg;
+  f->sched = s;
+
+  s->fibers[s->numFibers++] = f;
+  atomic_fetch_add(&s->live, 1);
+  makeReady(f);
+  return true;
+}
+
+// Runs f until it returns or parks, then finishes the park on this stack
+static void fiberRun(fiberThread *t, fiber *f) {
+  t->current = f;
+  if (_setjmp(t->ctx) == 0) {
+    if (!f->started) {
+      f->started = true;
+      setcontext(&f->start);
+    }
+    _longjmp(f->ctx, 1);
+  }
+
+  if (f->done) {
+    atomic_fetch_sub(&f->sched->live, 1);
+    return;
+  }
+
+  fiberWaitList *wl = t->parkOn;
+  lock(wl);
+  // Count in before the check, so a waker either sees the fiber or the
+  // check sees what the waker did
+  atomic_fetch_add(&wl->len, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (t->ready(t->readyArg)) {
+    atomic_fetch_sub(&wl->len, 1);
+    unlock(wl);
+    makeReady(f);
+    return;
+  }
+  f->next = NULL;
+  if (wl->tail != NULL)
+    wl->tail->next = f;
+  else
+    wl->head = f;
+  wl->tail = f;
+  unlock(wl);
+}
+
+static void *fiberWorker(void *args) {
+  fiberScheduler *s = (fiberScheduler *)args;
+  fiberThread *t = thisThread();
+  workFunction w;
+  long slot;
+  int spins = 0;
+
+  while (atomic_load(&s->live) > 0) {
+    if (!queueTryDel(s->ready, &w, &slot)) {
+      backoff(&spins);
+      continue;
+    }
+    spins = 0;
+    fiberRun(t, (fiber *)w.arg);
+  }
+
+  return (NULL);
+}
+
+void fiberSchedulerRun(fiberScheduler *s) {
+  pthread_attr_t attr;
+  cpu_set_t set;
+  int started = 0;
+
+  for (int i = 0; i < s->numWorkers; i++) {
+    pthread_attr_init(&attr);
+    if (s->pin) {
+      CPU_ZERO(&set);
+      CPU_SET(i % sysconf(_SC_NPROCESSORS_ONLN), &set);
+      pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    int rc = pthread_create(&s->workers[started], &attr, fiberWorker, s);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+      printf("Error creating threads %d\n", rc);
+      continue;
+    }
+    started++;
+  }
+  if (started == 0)
+    fiberWorker(s);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(s->workers[i], NULL);
+}
+
+void fiberPark(fiberWaitList *wl, bool (*ready)(void *), void *arg) {
+  fiberThread *t = thisThread();
+  fiber *f = t->current;
+
+  t->parkOn = wl;
+  t->ready = ready;
+  t->readyArg = arg;
+  if (_setjmp(f->ctx) == 0)
+    _longjmp(t->ctx, 1);
+}
+
+static void wake(fiberWaitList *wl, bool all) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&wl->len, memory_order_relaxed) == 0)
+    return;
+
+  lock(wl);
+  fiber *woken = wl->head;
+  fiber *last = all ? wl->tail : woken;
+  if (woken != NULL) {
+    wl->head = last->next;
+    if (wl->head == NULL)
+      wl->tail = NULL;
+    last->next = NULL;
+  }
+  for (fiber *f = woken; f != NULL; f = f->next)
+    atomic_fetch_sub(&wl->len, 1);
+  unlock(wl);
+
+  while (woken != NULL) {
+    fiber *next = woken->next;
+    makeReady(woken);
+    woken = next;
+  }
+}
+
+void fiberWake(fiberWaitList *wl) { wake(wl, false); }
+
+void fiberWakeAll(fiberWaitList *wl) { wake(wl, true); }
+
+static void waitListInit(fiberWaitList *wl) {
+  atomic_flag_clear(&wl->lock);
+  atomic_init(&wl->len, 0);
+  wl->head = wl->tail = NULL;
+}
+
+void fiberQueueInit(fiberQueue *fq, queue *q) {
+  fq->q = q;
+  waitListInit(&fq->notFull);
+  waitListInit(&fq->notEmpty);
+}
+
+typedef struct {
+  fiberQueue *fq;
+  workFunction *item;
+  long slot;
+  bool done; // also when the check before a park succeeded
+} fiberAttempt;
+
+static bool attemptAdd(void *arg) {
+  fiberAttempt *a = (fiberAttempt *)arg;
+  a->done = queueTryAdd(a->fq->q, a->item, &a->slot);
+  return a->done;
+}
+
+// Also done once the queue is closed and drained, with slot -1
+static bool attemptDel(void *arg) {
+  fiberAttempt *a = (fiberAttempt *)arg;
+  queue *q = a->fq->q;
+  if (queueTryDel(q, a->item, &a->slot))
+    return (a->done = true);
+  if (!atomic_load(&q->closed))
+    return false;
+  if (!queueTryDel(q, a->item, &a->slot))
+    a->slot = -1;
+  return (a->done = true);
+}
+
+long fiberQueueAdd(fiberQueue *fq, workFunction *in) {
+  fiberAttempt a = {fq, in, -1, false};
+
+  while (!attemptAdd(&a)) {
+    fiberPark(&fq->notFull, attemptAdd, &a);
+    if (a.done)
+      break;
+  }
+  fiberWake(&fq->notEmpty);
+  return a.slot;
+}
+
+long fiberQueueDel(fiberQueue *fq, workFunction *out) {
+  fiberAttempt a = {fq, out, -1, false};
+
+  while (!attemptDel(&a)) {
+    fiberPark(&fq->notEmpty, attemptDel, &a);
+    if (a.done)
+      break;
+  }
+  if (a.slot >= 0)
+    fiberWake(&fq->notFull);
+  return a.slot;
+}
+
+void fiberQueueClose(fiberQueue *fq) {
+  atomic_store(&fq->q->closed, true);
+  fiberWakeAll(&fq->notEmpty);
+}
@@ -0,0 +1,105 @@
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <ucontext.h>
+
+#include "queue.h"
+
+// Stack of every fiber, enough for printf and the work functions
+#define FIBER_STACK (64 * 1024)
+
+typedef struct fiber {
+  jmp_buf ctx; // where the fiber left off, once it ran
+  ucontext_t start;
+  bool started, done;
+  void *(*fn)(void *);
+  void *arg;
+  char *stack;
+  struct fiberScheduler *sched;
+  struct fiber *next; // in a wait list
+} fiber;
+
+/**
+ * Fibers parked until a condition may have become true, e.g. a queue is no
+ * longer empty. The lock is a spinlock, it is held for a few pointer moves.
+ */
+typedef struct {
+  atomic_flag lock;
+  atomic_int len;
+  fiber *head, *tail;
+} fiberWaitList;
+
+/**
+ * M:N scheduler. The fibers are spawned before fiberSchedulerRun and share
+ * one run queue, an MPMC ring with room for all of them, that numWorkers
+ * threads take from until every fiber is done. A fiber runs until it
+ * returns or parks, nothing preempts it.
+ */
+typedef struct fiberScheduler {
+  queue *ready;
+  fiber **fibers;
+  int numFibers, maxFibers;
+  atomic_int live; // fibers not done yet
+  pthread_t *workers;
+  int numWorkers;
+  bool pin; // worker i on cpu i
+} fiberScheduler;
+
+fiberScheduler *fiberSchedulerInit(int numWorkers, int maxFibers, bool pin);
+
+/**
+ * Frees the fibers and their stacks, after fiberSchedulerRun
+ */
+void fiberSchedulerDelete(fiberScheduler *s);
+
+/**
+ * Returns false once maxFibers fibers were spawned
+ */
+bool fiberSpawn(fiberScheduler *s, void *(*fn)(void *), void *arg);
+
+/**
+ * Runs the fibers on the workers and returns when all of them are done
+ */
+void fiberSchedulerRun(fiberScheduler *s);
+
+/**
+ * Called from a fiber. Switches back to the worker, which calls ready(arg)
+ * with the lock of wl held and either runs the fiber again or parks it on wl
+ * until fiberWake. The check runs after the switch so that a waker never
+ * resumes a fiber that is still on its stack.
+ */
+void fiberPark(fiberWaitList *wl, bool (*ready)(void *), void *arg);
+
+/**
+ * Called after the condition of wl may have become true, from a fiber or
+ * not. Makes one/every parked fiber runnable, and costs one load when none is
+ * parked.
+ */
+void fiberWake(fiberWaitList *wl);
+void fiberWakeAll(fiberWaitList *wl);
+
+/**
+ * A queue of any backend for fibers: full and empty park the fiber instead of
+ * the thread
+ */
+typedef struct {
+  queue *q;
+  fiberWaitList notFull, notEmpty;
+} fiberQueue;
+
+void fiberQueueInit(fiberQueue *fq, queue *q);
+
+/**
+ * As queueAdd and queueDel, from a fiber
+ */
+long fiberQueueAdd(fiberQueue *fq, workFunction *in);
+long fiberQueueDel(fiberQueue *fq, workFunction *out);
+
+/**
+ * As queueClose, also wakes the parked consumer fibers
+ */
+void fiberQueueClose(fiberQueue *fq);
+
+#endif
@@ -0,0 +1,141 @@
+#include "lanes.h"
+
+#include <stdlib.h>
+
+lanes *lanesInit(int numLanes, long size) {
+  lanes *l;
+
+  l = (lanes *)malloc(sizeof(lanes));
+  if (l == NULL)
+    return (NULL);
+  l->lanes = (lane *)cacheAlloc(numLanes * sizeof(lane));
+  if (l->lanes == NULL) {
+    free(l);
+    return (NULL);
+  }
+  l->numLanes = numLanes;
+  l->size = size;
+  atomic_init(&l->closed, false);
+
+  for (int i = 0; i < numLanes; i++) {
+    lane *ln = &l->lanes[i];
+    atomic_init(&ln->wanted, false);
+    if (!laneRingInit(&ln->ring, size)) {
+      l->numLanes = i;
+      lanesDelete(l);
+      return (NULL);
+    }
+    if (!laneLootRingInit(&ln->loot, 0)) {
+      laneRingDestroy(&ln->ring);
+      l->numLanes = i;
+      lanesDelete(l);
+      return (NULL);
+    }
+  }
+
+  return (l);
+}
+
+void lanesDelete(lanes *l) {
+  for (int i = 0; i < l->numLanes; i++) {
+    laneRingDestroy(&l->lanes[i].ring);
+    laneLootRingDestroy(&l->lanes[i].loot);
+  }
+  free(l->lanes);
+  free(l);
+}
+
+long lanesAdd(lanes *l, int id, workFunction *in) {
+  workFunction item = *in;
+  long slot;
+  int spins = 0;
+
+  item.enqueuedNs = monotonicNs();
+  while (!laneRingTryPush(&l->lanes[id].ring, &item, &slot))
+    backoff(&spins);
+  TRACE_EVENT(TRACE_ENQUEUE, id * l->size + slot);
+
+  return id * l->size + slot;
+}
+
+/*
+ * The owner takes up to LANE_BATCH items from its lane. If a thief asked, the
+ * newer half goes to the loot ring, last first, so the ones the loot ring has
+ * no room for are still at the end of out.
+ */
+static int laneTake(lanes *l, int id, workFunction *out, long *slots) {
+  lane *ln = &l->lanes[id];
+  long slot;
+  int n = laneRingTryPopN(&ln->ring, out, LANE_BATCH, &slot);
+
+  for (int i = 0; i < n; i++)
+    slots[i] = id * l->size + (slot + i) % l->size;
+  if (n > 1 && atomic_load_explicit(&ln->wanted, memory_order_relaxed) &&
+      atomic_exchange_explicit(&ln->wanted, false, memory_order_relaxed)) {
+    laneLoot loot[LANE_BATCH / 2];
+    int give = n / 2;
+    for (int i = 0; i < give; i++)
+      loot[i] = (laneLoot){out[n - 1 - i], slots[n - 1 - i]};
+    n -= laneLootRingTryPushN(&ln->loot, loot, give, &slot);
+  }
+  for (int i = 0; i < n; i++)
+    TRACE_EVENT(TRACE_DEQUEUE, slots[i]);
+  return n;
+}
+
+/*
+ * Takes what an owner handed out, or else asks the busiest lane for work.
+ * Returns -1 when every lane and every loot ring is empty.
+ */
+static int steal(lanes *l, workFunction *out, long *slots) {
+  laneLoot loot[LANE_BATCH];
+  int victim = -1;
+  long most = 0, slot;
+
+  for (int i = 0; i < l->numLanes; i++) {
+    int n = laneLootRingTryPopN(&l->lanes[i].loot, loot, LANE_BATCH, &slot);
+    for (int j = 0; j < n; j++) {
+      out[j] = loot[j].item;
+      slots[j] = loot[j].slot;
+      TRACE_EVENT(TRACE_DEQUEUE, slots[j]);
+    }
+    if (n > 0)
+      return n;
+  }
+  for (int i = 0; i < l->numLanes; i++) {
+    lane *ln = &l->lanes[i];
+    long depth = laneRingLen(&ln->ring) + laneLootRingLen(&ln->loot);
+    if (depth > most) {
+      most = depth;
+      victim = i;
+    }
+  }
+  if (victim < 0)
+    return -1;
+  if (!atomic_load_explicit(&l->lanes[victim].wanted, memory_order_relaxed))
+    atomic_store_explicit(&l->lanes[victim].wanted, true,
+                          memory_order_relaxed);
+  return 0;
+}
+
+int lanesDel(lanes *l, int id, int numConsumers, workFunction *out,
+             long *slots) {
+  int spins = 0, n;
+
+  for (;;) {
+    // Every add finished before the close, so one more pass decides
+    bool closed = atomic_load(&l->closed);
+
+    for (int i = id; i < l->numLanes; i += numConsumers) {
+      if ((n = laneTake(l, i, out, slots)) > 0)
+        return n;
+    }
+    if ((n = steal(l, out, slots)) > 0)
+      return n;
+    if (closed && n < 0)
+      return 0;
+    backoff(&spins);
+  }
+}
+
+void lanesClose(lanes *l) { atomic_store(&l->closed, true); }
@@ -0,0 +1,62 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "queue.h"
+
+// Most items a consumer takes from a lane with one CAS
+#define LANE_BATCH 16
+
+/**
+ * Every producer owns a lane, a single producer single consumer ring of
+ * ring.h whose one consumer, the owner of the lane, is consumer
+ * l % numConsumers. Both ends are wait-free. A consumer whose lanes are empty
+ * asks the busiest lane for work, and its owner hands the newer half of its
+ * next batch, at most LANE_BATCH / 2 items, to the loot ring of the lane.
+ * Thieves only take from loot rings, claiming their cells with a CAS, so they
+ * never touch the lane itself.
+ */
+RING_DEFINE(laneRing, workFunction, 0, RING_SPSC)
+
+// An item an owner handed to thieves, with its slot as numbered by lanesAdd
+typedef struct {
+  workFunction item;
+  long slot;
+} laneLoot;
+
+RING_DEFINE(laneLootRing, laneLoot, LANE_BATCH, RING_MPMC)
+
+typedef struct {
+  laneRing ring;
+  laneLootRing loot;
+  atomic_bool wanted CACHE_ALIGNED; // set by thieves, cleared by the owner
+} lane;
+
+typedef struct {
+  lane *lanes;
+  int numLanes;
+  long size;
+  atomic_bool closed;
+} lanes;
+
+lanes *lanesInit(int numLanes, long size);
+void lanesDelete(lanes *l);
+
+/**
+ * Blocks while the lane is full. Returns lane * size + the slot of the item.
+ */
+long lanesAdd(lanes *l, int lane, workFunction *in);
+
+/**
+ * Takes up to LANE_BATCH items for consumer id. Blocks while every lane is
+ * empty and returns 0 once the lanes are closed and drained. The slot of every
+ * item, numbered as in lanesAdd, is returned through slots.
+ */
+int lanesDel(lanes *l, int id, int numConsumers, workFunction *out,
+             long *slots);
+
+/**
+ * The producers are done. Consumers drain the lanes and then get 0.
+ */
+void lanesClose(lanes *l);
+
+#endif
@@ -0,0 +1,176 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+// Payloads are aligned for any type up to 16 bytes
+#define POOL_ALIGN 16
+
+typedef struct poolBlock {
+  struct poolBlock *next; // in a magazine, a remote list or a chain
+  struct poolCache *owner;
+} __attribute__((aligned(POOL_ALIGN))) poolBlock;
+
+typedef struct poolSlab {
+  struct poolSlab *next; // every slab of the pool, to free them
+} __attribute__((aligned(POOL_ALIGN))) poolSlab;
+
+typedef struct poolCache {
+  _Atomic(poolBlock *) remote CACHE_ALIGNED; // pushed by the other threads
+  poolBlock *magazine CACHE_ALIGNED;
+  // Blocks of outOwner on their way back
+  poolBlock *outHead, *outTail;
+  struct poolCache *outOwner;
+  int outLen;
+  atomic_bool abandoned; // its thread exited
+  struct poolCache *next; // every cache of the pool
+} poolCache;
+
+struct payloadPool {
+  size_t blockSize; // header and payload
+  pthread_key_t key; // the cache of the thread
+  _Atomic(poolCache *) caches;
+  _Atomic(poolSlab *) slabs;
+};
+
+static void remotePush(poolCache *owner, poolBlock *head, poolBlock *tail) {
+  poolBlock *top = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+  do {
+    tail->next = top;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &owner->remote, &top, head, memory_order_release, memory_order_relaxed));
+}
+
+static void flush(poolCache *c) {
+  if (c->outHead == NULL)
+    return;
+  remotePush(c->outOwner, c->outHead, c->outTail);
+  c->outHead = c->outTail = NULL;
+  c->outOwner = NULL;
+  c->outLen = 0;
+}
+
+// Runs when a thread that used the pool exits
+static void cacheAbandon(void *arg) {
+  poolCache *c = (poolCache *)arg;
+  flush(c);
+  atomic_store(&c->abandoned, true);
+}
+
+static poolCache *cacheGet(payloadPool *p) {
+  poolCache *c = (poolCache *)pthread_getspecific(p->key);
+  if (c != NULL)
+    return c;
+
+  for (c = atomic_load(&p->caches); c != NULL; c = c->next) {
+    bool abandoned = true;
+    if (atomic_compare_exchange_strong(&c->abandoned, &abandoned, false))
+      break;
+  }
+  if (c == NULL) {
+    c = (poolCache *)cacheAlloc(sizeof(poolCache));
+    if (c == NULL)
+      return (NULL);
+    c->next = atomic_load(&p->caches);
+    while (!atomic_compare_exchange_weak(&p->caches, &c->next, c))
+      ;
+  }
+  pthread_setspecific(p->key, c);
+  return c;
+}
+
+// Fills the empty magazine of c with a new slab
+static bool carve(payloadPool *p, poolCache *c) {
+  poolSlab *s =
+      (poolSlab *)malloc(sizeof(poolSlab) + POOL_MAGAZINE * p->blockSize);
+  if (s == NULL)
+    return false;
+  s->next = atomic_load(&p->slabs);
+  while (!atomic_compare_exchange_weak(&p->slabs, &s->next, s))
+    ;
+
+  char *blocks = (char *)(s + 1);
+  for (int i = POOL_MAGAZINE - 1; i >= 0; i--) {
+    poolBlock *b = (poolBlock *)(blocks + i * p->blockSize);
+    b->owner = c;
+    b->next = c->magazine;
+    c->magazine = b;
+  }
+  return true;
+}
+
+payloadPool *poolInit(size_t size) {
+  payloadPool *p;
+
+  p = (payloadPool *)malloc(sizeof(payloadPool));
+  if (p == NULL)
+    return (NULL);
+  if (pthread_key_create(&p->key, cacheAbandon) != 0) {
+    free(p);
+    return (NULL);
+  }
+  p->blockSize = (sizeof(poolBlock) + size + POOL_ALIGN - 1) / POOL_ALIGN *
+                 POOL_ALIGN;
+  atomic_init(&p->caches, NULL);
+  atomic_init(&p->slabs, NULL);
+
+  return (p);
+}
+
+void poolDelete(payloadPool *p) {
+  pthread_key_delete(p->key);
+  for (poolSlab *s = atomic_load(&p->slabs), *next; s != NULL; s = next) {
+    next = s->next;
+    free(s);
+  }
+  for (poolCache *c = atomic_load(&p->caches), *next; c != NULL; c = next) {
+    next = c->next;
+    free(c);
+  }
+  free(p);
+}
+
+void *poolAlloc(payloadPool *p) {
+  poolCache *c = cacheGet(p);
+  if (c == NULL)
+    return (NULL);
+
+  if (c->magazine == NULL) {
+    c->magazine =
+        atomic_exchange_explicit(&c->remote, NULL, memory_order_acquire);
+    if (c->magazine == NULL && !carve(p, c))
+      return (NULL);
+  }
+  poolBlock *b = c->magazine;
+  c->magazine = b->next;
+  return b + 1;
+}
+
+void poolFree(payloadPool *p, void *payload) {
+  poolBlock *b = (poolBlock *)payload - 1;
+  poolCache *c = cacheGet(p);
+
+  if (c == NULL) {
+    remotePush(b->owner, b, b);
+    return;
+  }
+  if (b->owner == c) {
+    b->next = c->magazine;
+    c->magazine = b;
+    return;
+  }
+
+  // A chain holds the blocks of one owner
+  if (c->outOwner != b->owner)
+    flush(c);
+  b->next = c->outHead;
+  c->outHead = b;
+  if (c->outTail == NULL)
+    c->outTail = b;
+  c->outOwner = b->owner;
+  if (++c->outLen == POOL_MAGAZINE)
+    flush(c);
+}
@@ -0,0 +1,42 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Blocks a thread carves at once, and frees to another thread it gathers
+// before handing them back
+#define POOL_MAGAZINE 64
+
+/**
+ * Pool of fixed size payloads for items that a producer allocates and a
+ * consumer frees. Every thread has a cache with a magazine, a free list only
+ * it touches, and every block belongs to the cache that carved it. A thread
+ * frees its own blocks into its magazine, and gathers the blocks of another
+ * owner into a chain that it pushes onto the remote list of the owner with
+ * one CAS. The owner takes the whole remote list with one exchange when its
+ * magazine runs empty, so the list only ever sees pushes and has no ABA.
+ *
+ * A cache outlives its thread and the next new thread adopts it, with the
+ * blocks still on its way back.
+ */
+typedef struct payloadPool payloadPool;
+
+payloadPool *poolInit(size_t size);
+
+/**
+ * Frees every block, after the threads that used the pool exited
+ */
+void poolDelete(payloadPool *p);
+
+/**
+ * Returns NULL when malloc fails
+ */
+void *poolAlloc(payloadPool *p);
+
+/**
+ * From any thread
+ */
+void poolFree(payloadPool *p, void *payload);
+
+#endif
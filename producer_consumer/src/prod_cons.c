@@ -15,71 +15,216 @@
  *	Revised	:
  */
 
+#define _GNU_SOURCE
+
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "fiber.h"
+#include "lanes.h"
+#include "queue.h"
+#include "shards.h"
+#include "shm.h"
+#include "trace.h"
+#include "work.h"
+
 /**
  * It should be noted that using global variables is a bad practice!
  */
 
-FILE *results;
-/*
- * Requires to create two objects of struct timespec tic, toc to count time
- */
-#define TIC(i) clock_gettime(CLOCK_MONOTONIC, &tic[i]);
-#define TOC(i)                                                                 \
-  clock_gettime(CLOCK_MONOTONIC, &toc[i]);                                     \
-  fprintf(results, "%d, %d, %d, %d, %f,%d\n", QUEUESIZE, loop, numProThreads,  \
-          numConThreads, diff_time(tic[i], toc[i]) * 1000, i);
-
 #ifndef QUEUESIZE
 #define QUEUESIZE 20
 #endif
 int loop;
 int numProThreads;
 int numConThreads;
+// Producers pause for pauseUs after every burst items, 0 never pauses
+int burst;
+long pauseUs;
+// Relative deadline of the items, 0 for none
+long deadlineUs;
+// The queue of the fiber mode, closed by the last producer fiber
+fiberQueue fiberFifo;
+atomic_int fiberProducers;
+// Producers and consumers time their queue operations
+bool timeBlocking;
+atomic_bool hogStop;
+// Bytes of the payload of every item, 0 for none
+long payloadSize;
+// What workQueue does for every item
+workLoad workload;
+// Items a producer adds and a consumer takes per queue operation
+int batch;
+// Processes of the shm backend kill themselves once in this queue operation
+long crashAt;
+
+// The interferer spins for HOG_BUSY_US out of every HOG_PERIOD_US
+#define HOG_BUSY_US 1000
+#define HOG_PERIOD_US 2000
+
+// Backend number of the lanes, after the queue backends
+#define BACKEND_LANES QUEUE_NUM_BACKENDS
+// and of the queue between processes
+#define BACKEND_SHM (QUEUE_NUM_BACKENDS + 1)
+#define MAX_SWEEP 16
+#define MAX_BATCH 1024
+
+/**
+ * Latencies a consumer measured, written out after the run so that no stdio
+ * happens while items are moving
+ */
+typedef struct {
+  uint64_t latencyNs; // from queueAdd to queueDel
+  uint64_t enqueuedNs;
+  long slot;
+  int64_t latenessNs; // done minus deadline, negative when early
+} latencySample;
 
 typedef struct {
-  void *(*work)(void *);
-  void *arg;
-  int value;
-} workFunction;
+  latencySample *samples;
+  long len, cap;
+} latencyLog;
 
+/**
+ * Time spent in queueAdd/queueDel, blocked on the lock or on a full/empty
+ * queue
+ */
 typedef struct {
-  workFunction buf[QUEUESIZE];
-  // int buf[QUEUESIZE];
-  long head, tail;
-  int full, empty;
-  pthread_mutex_t *mut;
-  pthread_cond_t *notFull, *notEmpty;
-} queue;
+  long ops;
+  uint64_t totalNs, maxNs;
+  long hist[64]; // ops by the log2 of their ns
+} blockStats;
 
 typedef struct {
-  queue *q;
+  queue *q; // in the sharded mode the first shard, for the payloads
+  lanes *l; // set instead of q in the lanes mode
+  shards *s; // set in the sharded mode
   int tid;
+  latencyLog log;
+  long periodUs;   // producers only, 0 adds the items back to back
+  int64_t *jitter; // wake-up minus activation time of every activation
+  struct timespec start; // first activation
+  int priority;           // SCHED_FIFO, 0 for the default policy
+  blockStats block;
 } pthread_data;
 
+typedef struct {
+  long values[MAX_SWEEP];
+  int n;
+} sweep;
+
+/**
+ * One configuration of the sweep
+ */
+typedef struct {
+  long queueSize;
+  int loop;
+  int producers;
+  int consumers;
+  int backend; // a queueBackend or BACKEND_LANES
+  int wait;
+  bool pin;
+  int burst;
+  long pauseUs;
+  long deadlineUs;
+  sweep *periods; // of the producers round robin, NULL for back to back
+  long startDelayUs;
+  int fiberWorkers; // 0 runs every producer and consumer on its own thread
+  int lock;         // lockProtocol of the locked backends
+  sweep *proPrios;  // SCHED_FIFO priorities round robin, 0 for the default
+  sweep *conPrios;
+  int hogPrio; // of the cpu hog, 0 for none
+  long payload;  // bytes, 0 for none
+  int allocator; // payloadAllocator of the payloads
+  int shards;    // queues of the sharded mode, 0 for one queue
+  int kernel;    // workKernel of the items
+  long cost;     // of every item, in units of the kernel
+  int batch;     // items per queueAddN/queueDelN, 1 for queueAdd/queueDel
+} runConfig;
+
+typedef struct {
+  double seconds;
+  double cpu; // user plus system time of all threads
+  latencyLog *logs; // one per consumer
+  int64_t **jitter; // one per producer, NULL unless periodic
+  blockStats *proBlock, *conBlock; // one per thread, NULL unless timed
+} runResult;
+
+/**
+ * The buffer is sized for an even share of the items and only grows if the
+ * consumer takes more than that
+ */
+void latencyRecord(latencyLog *log, workFunction *item, long slot);
+
+/**
+ * Adds the time since startNs, taken with blockStart before the operation,
+ * when the operations are timed
+ */
+void blockRecord(blockStats *b, uint64_t startNs);
+
+static inline uint64_t blockStart() { return timeBlocking ? monotonicNs() : 0; }
+
+/**
+ * Lateness of the item the last latencyRecord was for, once it has run
+ */
+void latenessRecord(latencyLog *log, workFunction *item);
+
+/**
+ * Sets the release time of the item and, with deadlines, a random deadline
+ * after it
+ */
+void itemRelease(workFunction *item, uint64_t releaseNs, unsigned *seed);
+
+/**
+ * A payload from q filled with the item number, released by the consumer
+ */
+void *payloadMake(queue *q, int value);
+
 void *producer(void *args);
+
+/**
+ * Adds one item every periodUs on an absolute schedule, so a late activation
+ * does not push the later ones back
+ */
+void *producerPeriodic(void *args);
 void *consumer(void *args);
+void *consumerLanes(void *args);
 
-queue *queueInit(int numThreads);
-void queueDelete(queue *q);
-void queueAdd(queue *q, int in);
-void queueDel(queue *q, int *out);
+/**
+ * Producer and consumer of the fiber mode, on fiberFifo
+ */
+void *producerFiber(void *args);
+void *consumerFiber(void *args);
+
+/**
+ * Producer and consumer processes of the shm backend, on the region name. life
+ * counts the restarts of the role, and only the first life crashes with -X. A
+ * consumer logs into log and keeps its length in len, both shared with the
+ * process that started it.
+ */
+void producerProcess(const char *name, int id, int life);
+void consumerProcess(const char *name, int id, int life, latencyLog *log,
+                     long *len);
 
 /**
- * Keep track if consumers are finished in order to send conditional signal
- * when there aren't producers to wake them up
+ * Spins on its cpu with a duty cycle until hogStop, to preempt the threads
+ * of lower priority
  */
-bool areConsumersFinished(int numConThreads);
+void *cpuHog(void *args);
+
 /**
- * The function that each producer and consumer is calling
+ * The function that each consumer is calling for every item
  */
 void *workQueue(void *args);
 
@@ -88,232 +233,1358 @@ void *workQueue(void *args);
  */
 double diff_time(struct timespec start, struct timespec end);
 
-bool areProducersFinished = false; // false if there are producers else true
-bool *isConsumerFinished;          // keep track if consumer finished its tasks
+/**
+ * User plus system time
+ */
+double cpuSeconds(struct rusage *usage);
 
-struct timespec *tic;
-struct timespec *toc;
+static const char *backendName(int backend) {
+  if (backend == BACKEND_SHM)
+    return "shm";
+  return backend == BACKEND_LANES ? "lanes" : queueBackends[backend]->name;
+}
 
-int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    printf("USAGE: ./bin/main <number of loops> <number of producers threads> "
-           "<number of "
-           "consumers threads>");
+static void usage() {
+  printf("USAGE: ./bin/main [-q locked,mpmc,ticket,segmented,edf,lanes,shm] "
+         "[-w spin,yield,futex,cond] [-Q queue sizes] [-b burst sizes] "
+         "[-p pause us] [-D deadline us] [-P periods us] [-S start delay us] "
+         "[-F fiber threads] [-L plain,inherit,protect] [-R priorities] "
+         "[-K priorities] [-H hog priority] [-A payload bytes] "
+         "[-M malloc,pool] [-s shards] "
+         "[-k compute,stream,chase,syscall,sleep] [-C costs] "
+         "[-B batch sizes] [-X crash op] [-r repetitions] [-W warm-up runs] "
+         "[-c] "
+         "[-o summary.csv|summary.json] <number of loops> <number of "
+         "producers threads> <number of consumers threads>\n"
+         "Every option but -p, -D, -P, -S, -F, -R, -K, -H, -X, -r, -W, -c and "
+         "-o "
+         "and every argument takes a comma separated list, and every "
+         "combination is run.\n"
+         "With -b every producer adds burst items back to back and then "
+         "sleeps for -p us (default 1000).\n"
+         "With -D every item is due a random 1/4 to 2 times -D us after its "
+         "producer releases it.\n"
+         "With -P producer i adds one item every i-th period of the list, "
+         "round robin, for <number of loops> activations starting -S us "
+         "after the start, and the wake-up jitter of every activation goes "
+         "to jitter.csv.\n"
+         "With -F producers and consumers are fibers on that many threads, "
+         "pinned with -c, and can not be bursty, periodic or sharded.\n"
+         "-R and -K give the SCHED_FIFO priority of producer/consumer i, "
+         "round robin, 0 for the default policy, and -H starts a cpu hog at "
+         "that priority. Their queue operations are then timed into "
+         "blocking.csv per class. -L picks the mutex protocol of the "
+         "locked and edf backends.\n"
+         "With -A every item carries a payload of that many bytes that the "
+         "producer allocates with -M and the consumer frees, except with "
+         "lanes.\n"
+         "With -s the queue is that many shards of the backend: producers "
+         "add to the shorter of two random shards and consumers take from "
+         "their own shard first, so items are only in FIFO order within a "
+         "shard. The ordering skew of an item is how much later the newest "
+         "item taken before it was added.\n"
+         "-k is the work of every item and -C its cost: sin calls, KiB read, "
+         "cache missing loads, getppid calls or us asleep. The default is "
+         "10 sin calls.\n"
+         "With -B producers add and consumers take up to that many items, "
+         "at most %d, per queue operation, a partial batch when the queue "
+         "is nearly full or empty. Lanes, shards and fibers take no "
+         "batches, and periodic producers add one item at a time.\n"
+         "-q shm runs every producer and consumer as a process of its own, "
+         "on a queue in shared memory with a robust mutex, without fibers, "
+         "periods, priorities, payloads, shards or batches. A process that "
+         "dies is started again, and with -X every process kills itself once "
+         "in its n-th queue operation, holding the mutex.\n"
+         "Without -o every run appends its items to results.csv and its "
+         "throughput to throughput.csv.\n",
+         MAX_BATCH);
+  exit(1);
+}
+
+static void parseSweep(sweep *s, char *arg, int (*byName)(const char *)) {
+  s->n = 0;
+  for (char *t = strtok(arg, ","); t != NULL && s->n < MAX_SWEEP;
+       t = strtok(NULL, ",")) {
+    long v = byName != NULL ? byName(t) : atol(t);
+    if (v < 0 || (byName == NULL && v == 0)) {
+      fprintf(stderr, "main: bad value %s\n", t);
+      usage();
+    }
+    s->values[s->n++] = v;
+  }
+}
+
+static int backendByName(const char *name) {
+  if (strcmp(name, "shm") == 0)
+    return BACKEND_SHM;
+  return strcmp(name, "lanes") == 0 ? BACKEND_LANES : queueBackendByName(name);
+}
+
+static int priorityByName(const char *name) {
+  int priority = atoi(name);
+  return priority <= sched_get_priority_max(SCHED_FIFO) ? priority : -1;
+}
+
+// NULL when the thread keeps the defaults
+static pthread_attr_t *threadAttr(pthread_attr_t *attr, bool pin, int cpu,
+                                  int priority) {
+  if (!pin && priority == 0)
+    return (NULL);
+  pthread_attr_init(attr);
+  if (pin) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+  }
+  if (priority > 0) {
+    struct sched_param param = {.sched_priority = priority};
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &param);
+  }
+  return attr;
+}
+
+// pthread_create with the attributes of threadAttr, which are destroyed again
+static int threadCreate(pthread_t *thread, bool pin, int cpu, int priority,
+                        void *(*fn)(void *), void *arg) {
+  pthread_attr_t attr, *a = threadAttr(&attr, pin, cpu, priority);
+  int rc = pthread_create(thread, a, fn, arg);
+  if (a != NULL)
+    pthread_attr_destroy(a);
+  return rc;
+}
+
+static bool sweepHas(sweep *s, long value) {
+  for (int i = 0; s != NULL && i < s->n; i++) {
+    if (s->values[i] == value)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Exits unless the process may use SCHED_FIFO when a class or the hog asks
+ * for it. A PRIO_PROTECT mutex refuses threads outside SCHED_FIFO, so with it
+ * every thread needs a class, and the main thread that closes the queue runs
+ * at the lowest SCHED_FIFO priority.
+ */
+static void checkPriorities(sweep *locks, sweep *proPrios, sweep *conPrios,
+                            int hogPrio) {
+  struct sched_param param = {.sched_priority = sched_get_priority_min(
+                                  SCHED_FIFO)};
+  bool protect = sweepHas(locks, LOCK_PROTECT);
+
+  if (protect && (proPrios == NULL || conPrios == NULL ||
+                  sweepHas(proPrios, 0) || sweepHas(conPrios, 0))) {
+    fprintf(stderr, "main: -L protect needs a priority for every producer "
+                    "and consumer\n");
+    usage();
+  }
+  if (proPrios == NULL && conPrios == NULL && hogPrio == 0)
+    return;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+    fprintf(stderr, "main: SCHED_FIFO needs root or CAP_SYS_NICE\n");
     exit(1);
   }
+  if (!protect) {
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+  }
+}
 
-  loop = atoi(argv[1]);
-  numProThreads = atoi(argv[2]);
-  numConThreads = atoi(argv[3]);
+static int classPriority(sweep *classes, int i) {
+  return classes != NULL ? classes->values[i % classes->n] : 0;
+}
 
-  queue *fifo;
-  pthread_t pro[numProThreads];
-  pthread_t con[numConThreads];
-  pthread_data dataPro[numProThreads];
-  pthread_data dataCon[numConThreads];
+// Roles up to numProThreads are the producers, the rest the consumers
+static pid_t roleSpawn(const char *name, int role, int life, long *lens,
+                       latencySample *samples, long items) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("main: fork");
+    exit(1);
+  }
+  if (pid > 0)
+    return pid;
+
+  if (role < numProThreads) {
+    producerProcess(name, role, life);
+  } else {
+    int id = role - numProThreads;
+    latencyLog log = {samples + id * items, lens[id], items};
+    consumerProcess(name, id, life, &log, &lens[id]);
+  }
+  _exit(0);
+}
+
+/*
+ * The shm backend: the items go through a shm_open region between producer
+ * and consumer processes forked from this one, which supervises them. A role
+ * killed by a signal is started again, and once every producer finished the
+ * queue is closed. The consumers log into memory shared with this process,
+ * since an item a consumer died with is never logged.
+ */
+static void runProcesses(runConfig *c, runResult *r) {
+  long items = (long)loop * numProThreads, restarts = 0, logged = 0;
+  int roles = numProThreads + numConThreads;
+  pid_t pids[roles];
+  int lives[roles];
+  char name[64];
+
+  snprintf(name, sizeof(name), "/prod_cons.%d", (int)getpid());
+  shmQueue *q = shmQueueCreate(name, c->queueSize, numProThreads);
+  size_t logBytes =
+      numConThreads * (sizeof(long) + items * sizeof(latencySample));
+  long *lens = (long *)mmap(NULL, logBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (q == NULL || lens == MAP_FAILED) {
+    fprintf(stderr, "main: Queue Init failed.\n");
+    exit(1);
+  }
+  latencySample *samples = (latencySample *)(lens + numConThreads);
 
-  tic = (struct timespec *)malloc(QUEUESIZE * sizeof(struct timespec));
-  toc = (struct timespec *)malloc(QUEUESIZE * sizeof(struct timespec));
+  struct timespec start, end;
+  struct rusage usageStart, usageEnd;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  getrusage(RUSAGE_CHILDREN, &usageStart);
 
-  results = fopen("results.csv", "a");
+  for (int i = 0; i < roles; i++) {
+    lives[i] = 0;
+    pids[i] = roleSpawn(name, i, 0, lens, samples, items);
+  }
+  int alive = roles, producersLeft = numProThreads, status;
+  while (alive > 0) {
+    pid_t pid = wait(&status);
+    int i = 0;
+    while (i < roles && pids[i] != pid)
+      i++;
+    if (i == roles)
+      continue;
+    const char *role = i < numProThreads ? "producer" : "consumer";
+    int id = i < numProThreads ? i : i - numProThreads;
+    if (WIFSIGNALED(status)) {
+      printf("Restarting %s process id: %d\n", role, id);
+      restarts++;
+      pids[i] = roleSpawn(name, i, ++lives[i], lens, samples, items);
+      continue;
+    }
+    if (WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "main: %s process %d failed\n", role, id);
+      exit(1);
+    }
+    printf("Joined %s process id: %d\n", role, id);
+    alive--;
+    // Consumers drain what is left and exit
+    if (i < numProThreads && --producersLeft == 0)
+      shmQueueClose(q);
+  }
 
-  isConsumerFinished = (bool *)malloc(numConThreads * sizeof(bool));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  getrusage(RUSAGE_CHILDREN, &usageEnd);
+  r->seconds = diff_time(start, end);
+  r->cpu = cpuSeconds(&usageEnd) - cpuSeconds(&usageStart);
+  r->jitter = NULL;
+  r->proBlock = r->conBlock = NULL;
+  r->logs = (latencyLog *)malloc(numConThreads * sizeof(latencyLog));
   for (int i = 0; i < numConThreads; i++) {
-    isConsumerFinished[i] = false;
+    latencyLog *log = &r->logs[i];
+    log->len = log->cap = lens[i];
+    log->samples = (latencySample *)malloc(
+        (log->len ? log->len : 1) * sizeof(latencySample));
+    memcpy(log->samples, samples + i * items,
+           log->len * sizeof(latencySample));
+    logged += log->len;
   }
+  printf("Throughput: %f items/s\nCPU time: %f s\nRestarts: %ld\n"
+         "Recoveries: %ld\nLost: %ld items\n",
+         items / r->seconds, r->cpu, restarts, shmQueueRecoveries(q),
+         items - logged);
+
+  munmap(lens, logBytes);
+  shmQueueUnmap(q);
+  shmQueueUnlink(name);
+}
+
+/*
+ * Runs one configuration. With pin, producers and then consumers are pinned
+ * round robin on the online cpus, and the cpu hog shares the cpu of the first
+ * producer.
+ */
+static void runOnce(runConfig *c, runResult *r) {
+  queue *fifo = NULL;
+  lanes *l = NULL;
+  pthread_t pro[c->producers];
+  pthread_t con[c->consumers];
+  pthread_data dataPro[c->producers];
+  pthread_data dataCon[c->consumers];
+  shards *sh = NULL;
+  bool useLanes = c->backend == BACKEND_LANES;
+
+  loop = c->loop;
+  numProThreads = c->producers;
+  numConThreads = c->consumers;
+  burst = c->burst;
+  pauseUs = c->pauseUs;
+  deadlineUs = c->deadlineUs;
+  timeBlocking = c->proPrios != NULL || c->conPrios != NULL || c->hogPrio;
+  payloadSize = c->payload;
+  batch = c->batch;
+  long items = (long)loop * numProThreads;
 
   printf("Numbero of loops: %d\nNumber of producers: %d\nNumber of consumers: "
-         "%d\n",
-         loop, numProThreads, numConThreads);
+         "%d\nQueue size: %ld\nQueue backend: %s\nWait strategy: %s\n"
+         "Burst: %d items every %ld us\nDeadline: %ld us\nLock: %s\n"
+         "Payload: %ld bytes from %s\nShards: %d\nWork: %s x %ld\n"
+         "Batch: %d\n",
+         loop, numProThreads, numConThreads, c->queueSize,
+         backendName(c->backend), waitNames[c->wait], burst, pauseUs,
+         deadlineUs, lockNames[c->lock], payloadSize,
+         payloadNames[c->allocator], c->shards, workNames[c->kernel], c->cost,
+         batch);
 
-  fifo = queueInit(numConThreads + numProThreads);
-  if (fifo == NULL) {
+  if (!workLoadInit(&workload, c->kernel, c->cost)) {
+    fprintf(stderr, "main: Work Init failed.\n");
+    exit(1);
+  }
+  if (c->backend == BACKEND_SHM) {
+    runProcesses(c, r);
+    workLoadDestroy(&workload);
+    return;
+  }
+
+  if (useLanes) {
+    l = lanesInit(numProThreads, c->queueSize);
+  } else if (c->shards > 0) {
+    sh = shardsInit(c->shards, c->backend, c->queueSize, c->wait, c->lock);
+    if (sh != NULL)
+      fifo = sh->shards[0].q;
+  } else {
+    fifo = queueInitLocking(c->backend, c->queueSize, c->wait, c->lock);
+  }
+  if ((fifo == NULL && l == NULL) ||
+      (fifo != NULL && payloadSize > 0 &&
+       !queuePayloadInit(fifo, payloadSize, c->allocator))) {
     fprintf(stderr, "main: Queue Init failed.\n");
     exit(1);
   }
 
+  struct timespec start, end;
+  struct rusage usageStart, usageEnd;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  getrusage(RUSAGE_SELF, &usageStart);
+
+  // Every periodic producer starts on the same absolute time
+  struct timespec first = start;
+  first.tv_sec += c->startDelayUs / 1000000;
+  first.tv_nsec += c->startDelayUs % 1000000 * 1000;
+  if (first.tv_nsec >= 1000000000) {
+    first.tv_sec++;
+    first.tv_nsec -= 1000000000;
+  }
+  r->jitter = NULL;
+  if (c->periods != NULL)
+    r->jitter = (int64_t **)malloc(numProThreads * sizeof(int64_t *));
+
+  fiberScheduler *fibers = NULL;
+  if (c->fiberWorkers > 0) {
+    fibers = fiberSchedulerInit(c->fiberWorkers, numProThreads + numConThreads,
+                                c->pin);
+    if (fibers == NULL) {
+      fprintf(stderr, "main: Fiber scheduler init failed.\n");
+      exit(1);
+    }
+    fiberQueueInit(&fiberFifo, fifo);
+    atomic_store(&fiberProducers, numProThreads);
+  }
+
   int rc;
+  pthread_t hog;
+  atomic_store(&hogStop, false);
+  if (c->hogPrio &&
+      (rc = threadCreate(&hog, c->pin, 0, c->hogPrio, cpuHog, NULL)) != 0) {
+    fprintf(stderr, "main: Error creating the cpu hog %d\n", rc);
+    exit(1);
+  }
+
   for (int i = 0; i < numProThreads; i++) {
     dataPro[i].tid = i;
     dataPro[i].q = fifo;
-    if (rc = pthread_create(&pro[i], NULL, producer, &dataPro[i])) {
-      printf("Error creating threads %d\n", rc);
+    dataPro[i].l = l;
+    dataPro[i].s = sh;
+    dataPro[i].periodUs = 0;
+    dataPro[i].jitter = NULL;
+    dataPro[i].priority = classPriority(c->proPrios, i);
+    memset(&dataPro[i].block, 0, sizeof(blockStats));
+    if (c->periods != NULL) {
+      dataPro[i].periodUs = c->periods->values[i % c->periods->n];
+      dataPro[i].jitter = (int64_t *)malloc(loop * sizeof(int64_t));
+      dataPro[i].start = first;
+      r->jitter[i] = dataPro[i].jitter;
+    }
+    if (fibers != NULL)
+      fiberSpawn(fibers, producerFiber, &dataPro[i]);
+    else if ((rc = threadCreate(
+                  &pro[i], c->pin, i, dataPro[i].priority,
+                  c->periods != NULL ? producerPeriodic : producer,
+                  &dataPro[i])) != 0) {
+      // The consumers would wait for its items forever
+      fprintf(stderr, "main: Error creating producer %d %d\n", i, rc);
+      exit(1);
     }
   }
 
+  r->logs = (latencyLog *)malloc(numConThreads * sizeof(latencyLog));
   for (int i = 0; i < numConThreads; i++) {
     dataCon[i].tid = i;
     dataCon[i].q = fifo;
-    if (rc = pthread_create(&con[i], NULL, consumer, &dataCon[i])) {
-      printf("Error creating threads %d\n", rc);
+    dataCon[i].l = l;
+    dataCon[i].s = sh;
+    dataCon[i].log.cap = items / numConThreads + 1;
+    dataCon[i].log.len = 0;
+    dataCon[i].log.samples =
+        (latencySample *)malloc(dataCon[i].log.cap * sizeof(latencySample));
+    dataCon[i].priority = classPriority(c->conPrios, i);
+    memset(&dataCon[i].block, 0, sizeof(blockStats));
+    if (fibers != NULL)
+      fiberSpawn(fibers, consumerFiber, &dataCon[i]);
+    else if ((rc = threadCreate(&con[i], c->pin, numProThreads + i,
+                                dataCon[i].priority,
+                                useLanes ? consumerLanes : consumer,
+                                &dataCon[i])) != 0) {
+      fprintf(stderr, "main: Error creating consumer %d %d\n", i, rc);
+      exit(1);
     }
   }
 
-  for (int i = 0; i < numProThreads; i++) {
-    pthread_join(pro[i], NULL);
-    printf("Joined producer id: %d\n", i);
+  if (fibers != NULL) {
+    fiberSchedulerRun(fibers);
+    fiberSchedulerDelete(fibers);
+    printf("Joined %d producer and %d consumer fibers on %d threads\n",
+           numProThreads, numConThreads, c->fiberWorkers);
+    for (int i = 0; i < numConThreads; i++)
+      r->logs[i] = dataCon[i].log;
+  } else {
+    for (int i = 0; i < numProThreads; i++) {
+      pthread_join(pro[i], NULL);
+      printf("Joined producer id: %d\n", i);
+    }
+
+    // Consumers drain what is left and exit
+    if (useLanes)
+      lanesClose(l);
+    else if (sh != NULL)
+      shardsClose(sh);
+    else
+      queueClose(fifo);
+
+    for (int i = 0; i < numConThreads; i++) {
+      pthread_join(con[i], NULL);
+      printf("Joined consumer id: %d\n", i);
+      r->logs[i] = dataCon[i].log;
+    }
   }
 
-  areProducersFinished = true; // all producers exited
+  if (c->hogPrio) {
+    atomic_store(&hogStop, true);
+    pthread_join(hog, NULL);
+  }
+  r->proBlock = r->conBlock = NULL;
+  if (timeBlocking) {
+    r->proBlock = (blockStats *)malloc(numProThreads * sizeof(blockStats));
+    r->conBlock = (blockStats *)malloc(numConThreads * sizeof(blockStats));
+    for (int i = 0; i < numProThreads; i++)
+      r->proBlock[i] = dataPro[i].block;
+    for (int i = 0; i < numConThreads; i++)
+      r->conBlock[i] = dataCon[i].block;
+  }
 
-  // spam signals until all consumer threads have finished
-  // Fix: Use broadcast
-  while (1) {
-    printf("Send signal if someone is blocked\n");
-    pthread_cond_signal(fifo->notEmpty); // unblock the waited thread
-    if (areConsumersFinished(numConThreads))
-      break;
-    usleep(10); // hibernate
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  getrusage(RUSAGE_SELF, &usageEnd);
+  r->seconds = diff_time(start, end);
+  // cpu time of all threads, the cost of spinning against sleeping
+  r->cpu = cpuSeconds(&usageEnd) - cpuSeconds(&usageStart);
+  printf("Throughput: %f items/s\nCPU time: %f s\n", items / r->seconds,
+         r->cpu);
+
+  if (useLanes)
+    lanesDelete(l);
+  else if (sh != NULL)
+    shardsDelete(sh);
+  else
+    queueDelete(fifo);
+  workLoadDestroy(&workload);
+}
+
+static void freeResult(runConfig *c, runResult *r) {
+  for (int i = 0; i < c->consumers; i++)
+    free(r->logs[i].samples);
+  free(r->logs);
+  if (r->jitter != NULL) {
+    for (int i = 0; i < c->producers; i++)
+      free(r->jitter[i]);
+    free(r->jitter);
   }
+  free(r->proBlock);
+  free(r->conBlock);
+}
 
-  for (int i = 0; i < numConThreads; i++) {
-    pthread_join(con[i], NULL);
-    printf("Joined consumer id: %d\n", i);
+// The periods of the producers, separated by ;
+static const char *periodsName(runConfig *c, char *buf, size_t len) {
+  buf[0] = '\0';
+  for (int i = 0; c->periods != NULL && i < c->periods->n; i++)
+    snprintf(buf + strlen(buf), len - strlen(buf), "%s%ld", i ? ";" : "",
+             c->periods->values[i]);
+  return buf;
+}
+
+// Upper bound of the bucket the p-th quantile of the ops falls in
+static uint64_t blockQuantile(long *hist, long ops, double p) {
+  long seen = 0;
+  for (int i = 0; i < 64; i++) {
+    seen += hist[i];
+    if (seen > p * (ops - 1))
+      return (2ULL << i) - 1;
   }
+  return 0;
+}
+
+// One blocking.csv row per class: the threads of one role and priority
+static void writeBlocking(runConfig *c, runResult *r) {
+  FILE *out = fopen("blocking.csv", "a");
+  const char *backend = backendName(c->backend), *wait = waitNames[c->wait];
+
+  for (int role = 0; role < 2; role++) {
+    sweep *classes = role == 0 ? c->proPrios : c->conPrios;
+    blockStats *threads = role == 0 ? r->proBlock : r->conBlock;
+    int numThreads = role == 0 ? c->producers : c->consumers;
+    int numClasses = classes != NULL ? classes->n : 1;
+
+    for (int k = 0; k < numClasses && k < numThreads; k++) {
+      blockStats b = {0};
+      for (int i = k; i < numThreads; i += numClasses) {
+        b.ops += threads[i].ops;
+        b.totalNs += threads[i].totalNs;
+        if (threads[i].maxNs > b.maxNs)
+          b.maxNs = threads[i].maxNs;
+        for (int j = 0; j < 64; j++)
+          b.hist[j] += threads[i].hist[j];
+      }
+      fprintf(out, "%ld,%d,%d,%d,%s,%s,%s,%d,%s,%d,%ld,%f,%f,%lu,%lu\n",
+              c->queueSize, c->loop, c->producers, c->consumers, backend,
+              wait, lockNames[c->lock], c->hogPrio,
+              role == 0 ? "producer" : "consumer", classPriority(classes, k),
+              b.ops, b.totalNs / 1e6, b.ops ? (double)b.totalNs / b.ops : 0,
+              (unsigned long)blockQuantile(b.hist, b.ops, 0.99),
+              (unsigned long)b.maxNs);
+    }
+  }
+
+  fclose(out);
+}
+
+typedef struct {
+  uint64_t takenNs, addedNs;
+} takeTime;
+
+static int cmpTaken(const void *a, const void *b) {
+  uint64_t x = ((const takeTime *)a)->takenNs,
+           y = ((const takeTime *)b)->takenNs;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Ordering skew of every item of the run, in the order they were taken: how
+ * much later than the item the newest item taken before it was added, 0 when
+ * the item left in FIFO order. Returns the number of items.
+ */
+static long orderSkew(runConfig *c, runResult *r, int64_t *skew) {
+  long n = 0;
+  for (int i = 0; i < c->consumers; i++)
+    n += r->logs[i].len;
+  takeTime *t = (takeTime *)malloc((n ? n : 1) * sizeof(takeTime));
+
+  n = 0;
+  for (int i = 0; i < c->consumers; i++) {
+    for (long j = 0; j < r->logs[i].len; j++) {
+      latencySample *sample = &r->logs[i].samples[j];
+      t[n].addedNs = sample->enqueuedNs;
+      t[n++].takenNs = sample->enqueuedNs + sample->latencyNs;
+    }
+  }
+  qsort(t, n, sizeof(takeTime), cmpTaken);
+  uint64_t newest = 0;
+  for (long i = 0; i < n; i++) {
+    skew[i] = newest > t[i].addedNs ? (int64_t)(newest - t[i].addedNs) : 0;
+    if (t[i].addedNs > newest)
+      newest = t[i].addedNs;
+  }
+
+  free(t);
+  return n;
+}
+
+// The per run rows of results.csv, throughput.csv and, when the producers
+// are periodic, jitter.csv and, when the queue operations are timed,
+// blocking.csv
+static void writeRun(runConfig *c, runResult *r) {
+  FILE *results = fopen("results.csv", "a");
+  FILE *throughput = fopen("throughput.csv", "a");
+  const char *backend = backendName(c->backend), *wait = waitNames[c->wait];
+  long items = (long)c->loop * c->producers, misses = 0, reordered = 0;
+  int64_t *skew = (int64_t *)malloc((items ? items : 1) * sizeof(int64_t));
+
+  long n = orderSkew(c, r, skew);
+  for (long i = 0; i < n; i++)
+    reordered += skew[i] > 0;
+  free(skew);
+
+  for (int i = 0; i < c->consumers; i++) {
+    latencyLog *log = &r->logs[i];
+    for (long j = 0; j < log->len; j++) {
+      misses += c->deadlineUs && log->samples[j].latenessNs > 0;
+      fprintf(results, "%ld, %d, %d, %d, %f,%ld,%s,%s,%f\n", c->queueSize,
+              c->loop, c->producers, c->consumers,
+              log->samples[j].latencyNs / 1e6, log->samples[j].slot, backend,
+              wait, c->deadlineUs ? log->samples[j].latenessNs / 1e6 : 0);
+    }
+  }
+  fprintf(throughput,
+          "%ld,%d,%d,%d,%s,%ld,%f,%f,%s,%f,%d,%ld,%ld,%ld,%ld,%s,%d,%ld,%s,"
+          "%ld,%d\n",
+          c->queueSize, c->loop, c->producers, c->consumers, backend, items,
+          r->seconds * 1000, items / r->seconds, wait, r->cpu * 1000,
+          c->burst, c->pauseUs, c->deadlineUs, misses, c->payload,
+          payloadNames[c->allocator], c->shards, reordered,
+          workNames[c->kernel], c->cost, c->batch);
+
+  if (r->jitter != NULL) {
+    FILE *jitter = fopen("jitter.csv", "a");
+    for (int i = 0; i < c->producers; i++)
+      for (int j = 0; j < c->loop; j++)
+        fprintf(jitter, "%ld,%d,%d,%s,%s,%d,%ld,%d,%f\n", c->queueSize,
+                c->producers, c->consumers, backend, wait, i,
+                c->periods->values[i % c->periods->n], j,
+                r->jitter[i][j] / 1e3);
+    fclose(jitter);
+  }
+
+  if (r->proBlock != NULL)
+    writeBlocking(c, r);
 
-  queueDelete(fifo);
-  free(isConsumerFinished);
-  free(tic);
-  free(toc);
   fclose(results);
+  fclose(throughput);
+}
+
+static int cmpUint64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int cmpInt64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void meanStd(double *v, long n, double *mean, double *std) {
+  double sum = 0, sumSq = 0;
+  for (long i = 0; i < n; i++)
+    sum += v[i];
+  *mean = n ? sum / n : 0;
+  for (long i = 0; i < n; i++)
+    sumSq += (v[i] - *mean) * (v[i] - *mean);
+  *std = n > 1 ? sqrt(sumSq / (n - 1)) : 0;
+}
+
+/*
+ * Runs the warm-up runs and the repetitions of one configuration and writes
+ * one summary row: items/s and cpu time over the repetitions and the latency
+ * of all their items
+ */
+static void summarize(runConfig *c, int warmup, int reps, FILE *out,
+                      bool json, bool first) {
+  runResult r;
+  double rate[reps], cpu[reps];
+  long items = (long)c->loop * c->producers, n = 0;
+  uint64_t *latency = (uint64_t *)malloc(items * reps * sizeof(uint64_t));
+  int64_t *lateness = (int64_t *)malloc(items * reps * sizeof(int64_t));
+  int64_t *jitter = (int64_t *)malloc(items * reps * sizeof(int64_t));
+  int64_t *skew = (int64_t *)malloc(items * reps * sizeof(int64_t));
+  long nj = 0, ns = 0;
+
+  for (int i = 0; i < warmup; i++) {
+    runOnce(c, &r);
+    freeResult(c, &r);
+  }
+  for (int i = 0; i < reps; i++) {
+    runOnce(c, &r);
+    rate[i] = items / r.seconds;
+    cpu[i] = r.cpu * 1000;
+    for (int j = 0; j < c->consumers; j++) {
+      for (long k = 0; k < r.logs[j].len; k++) {
+        lateness[n] = r.logs[j].samples[k].latenessNs;
+        latency[n++] = r.logs[j].samples[k].latencyNs;
+      }
+    }
+    for (int j = 0; r.jitter != NULL && j < c->producers; j++) {
+      for (int k = 0; k < c->loop; k++)
+        jitter[nj++] = r.jitter[j][k];
+    }
+    ns += orderSkew(c, &r, skew + ns);
+    if (r.proBlock != NULL)
+      writeBlocking(c, &r);
+    freeResult(c, &r);
+  }
+
+  double rateMean, rateStd, cpuMean, cpuStd, latMean, latStd;
+  meanStd(rate, reps, &rateMean, &rateStd);
+  meanStd(cpu, reps, &cpuMean, &cpuStd);
+  double *lat = (double *)malloc((n ? n : 1) * sizeof(double));
+  for (long i = 0; i < n; i++)
+    lat[i] = latency[i];
+  meanStd(lat, n, &latMean, &latStd);
+  qsort(latency, n, sizeof(uint64_t), cmpUint64);
+  uint64_t p50 = n ? latency[(long)(0.5 * (n - 1))] : 0;
+  uint64_t p99 = n ? latency[(long)(0.99 * (n - 1))] : 0;
+  free(latency);
+
+  // Without deadlines every item is on time
+  long misses = 0;
+  double lateMean = 0, lateStd;
+  int64_t lateP50 = 0, lateP99 = 0, lateMax = 0;
+  if (c->deadlineUs) {
+    for (long i = 0; i < n; i++) {
+      lat[i] = lateness[i];
+      misses += lateness[i] > 0;
+    }
+    meanStd(lat, n, &lateMean, &lateStd);
+    qsort(lateness, n, sizeof(int64_t), cmpInt64);
+    lateP50 = n ? lateness[(long)(0.5 * (n - 1))] : 0;
+    lateP99 = n ? lateness[(long)(0.99 * (n - 1))] : 0;
+    lateMax = n ? lateness[n - 1] : 0;
+  }
+  double missRatio = n ? (double)misses / n : 0;
+  free(lateness);
+
+  // Activation jitter of the periodic producers
+  double jitterMean = 0, jitterStd;
+  int64_t jitterP99 = 0, jitterMax = 0;
+  if (nj > 0) {
+    for (long i = 0; i < nj; i++)
+      lat[i] = jitter[i];
+    meanStd(lat, nj, &jitterMean, &jitterStd);
+    qsort(jitter, nj, sizeof(int64_t), cmpInt64);
+    jitterP99 = jitter[(long)(0.99 * (nj - 1))];
+    jitterMax = jitter[nj - 1];
+  }
+  free(lat);
+  free(jitter);
+
+  // Ordering skew, over the items of every repetition
+  long reordered = 0;
+  for (long i = 0; i < ns; i++)
+    reordered += skew[i] > 0;
+  qsort(skew, ns, sizeof(int64_t), cmpInt64);
+  double skewRatio = ns ? (double)reordered / ns : 0;
+  int64_t skewP99 = ns ? skew[(long)(0.99 * (ns - 1))] : 0;
+  int64_t skewMax = ns ? skew[ns - 1] : 0;
+  free(skew);
+  char periods[MAX_SWEEP * 24];
+  periodsName(c, periods, sizeof(periods));
+
+  const char *backend = backendName(c->backend), *wait = waitNames[c->wait];
+  if (json)
+    fprintf(out,
+            "%s\n  {\"queuesize\": %ld, \"loopsize\": %d, \"producers\": %d, "
+            "\"consumers\": %d, \"backend\": \"%s\", \"wait\": \"%s\", "
+            "\"pinned\": %s, \"reps\": %d, \"itemspersec_mean\": %f, "
+            "\"itemspersec_std\": %f, \"cputime_mean\": %f, "
+            "\"cputime_std\": %f, \"latency_mean_ns\": %f, "
+            "\"latency_std_ns\": %f, \"latency_p50_ns\": %lu, "
+            "\"latency_p99_ns\": %lu, \"burst\": %d, \"pause_us\": %ld, "
+            "\"deadline_us\": %ld, \"miss_ratio\": %f, "
+            "\"lateness_mean_ns\": %f, \"lateness_p50_ns\": %ld, "
+            "\"lateness_p99_ns\": %ld, \"lateness_max_ns\": %ld, "
+            "\"periods_us\": \"%s\", \"start_delay_us\": %ld, "
+            "\"jitter_mean_ns\": %f, \"jitter_p99_ns\": %ld, "
+            "\"jitter_max_ns\": %ld, \"fiber_threads\": %d, "
+            "\"lock\": \"%s\", \"hog_priority\": %d, "
+            "\"payload_bytes\": %ld, \"allocator\": \"%s\", "
+            "\"shards\": %d, \"skew_ratio\": %f, \"skew_p99_ns\": %ld, "
+            "\"skew_max_ns\": %ld, \"kernel\": \"%s\", \"cost\": %ld, "
+            "\"batch\": %d}",
+            first ? "" : ",", c->queueSize, c->loop, c->producers,
+            c->consumers, backend, wait, c->pin ? "true" : "false", reps,
+            rateMean, rateStd, cpuMean, cpuStd, latMean, latStd,
+            (unsigned long)p50, (unsigned long)p99, c->burst, c->pauseUs,
+            c->deadlineUs, missRatio, lateMean, (long)lateP50, (long)lateP99,
+            (long)lateMax, periods, c->startDelayUs, jitterMean,
+            (long)jitterP99, (long)jitterMax, c->fiberWorkers,
+            lockNames[c->lock], c->hogPrio, c->payload,
+            payloadNames[c->allocator], c->shards, skewRatio, (long)skewP99,
+            (long)skewMax, workNames[c->kernel], c->cost, c->batch);
+  else
+    fprintf(out,
+            "%ld,%d,%d,%d,%s,%s,%d,%d,%f,%f,%f,%f,%f,%f,%lu,%lu,%d,%ld,%ld,"
+            "%f,%f,%ld,%ld,%ld,%s,%ld,%f,%ld,%ld,%d,%s,%d,%ld,%s,%d,%f,%ld,"
+            "%ld,%s,%ld,%d\n",
+            c->queueSize, c->loop, c->producers, c->consumers, backend, wait,
+            c->pin, reps, rateMean, rateStd, cpuMean, cpuStd, latMean, latStd,
+            (unsigned long)p50, (unsigned long)p99, c->burst, c->pauseUs,
+            c->deadlineUs, missRatio, lateMean, (long)lateP50, (long)lateP99,
+            (long)lateMax, periods, c->startDelayUs, jitterMean,
+            (long)jitterP99, (long)jitterMax, c->fiberWorkers,
+            lockNames[c->lock], c->hogPrio, c->payload,
+            payloadNames[c->allocator], c->shards, skewRatio, (long)skewP99,
+            (long)skewMax, workNames[c->kernel], c->cost, c->batch);
+  fflush(out);
+}
+
+int main(int argc, char *argv[]) {
+  sweep backends = {{QUEUE_LOCKED}, 1}, waits = {{-1}, 1};
+  sweep sizes = {{QUEUESIZE}, 1}, bursts = {{0}, 1}, loops, producers,
+        consumers;
+  sweep periods, locks = {{LOCK_PLAIN}, 1}, proPrios, conPrios;
+  sweep payloads = {{0}, 1}, allocators = {{PAYLOAD_MALLOC}, 1};
+  sweep shardCounts = {{0}, 1}, kernels = {{WORK_COMPUTE}, 1},
+        costs = {{0}, 1}, batches = {{1}, 1};
+  long pause = 1000, deadline = 0, startDelay = 0;
+  bool periodic = false, proClasses = false, conClasses = false;
+  int reps = 1, warmup = 0, fiberWorkers = 0, hogPrio = 0;
+  bool pin = false;
+  const char *outPath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv,
+                       "q:w:Q:b:p:D:P:S:F:L:R:K:H:A:M:s:k:C:B:X:r:W:co:")) !=
+         -1) {
+    switch (opt) {
+    case 'q':
+      parseSweep(&backends, optarg, backendByName);
+      break;
+    case 'w':
+      parseSweep(&waits, optarg, waitByName);
+      break;
+    case 'Q':
+      parseSweep(&sizes, optarg, NULL);
+      break;
+    case 'b':
+      parseSweep(&bursts, optarg, NULL);
+      break;
+    case 'p':
+      pause = atol(optarg);
+      break;
+    case 'D':
+      deadline = atol(optarg);
+      break;
+    case 'P':
+      parseSweep(&periods, optarg, NULL);
+      periodic = true;
+      break;
+    case 'S':
+      startDelay = atol(optarg);
+      break;
+    case 'F':
+      fiberWorkers = atoi(optarg);
+      break;
+    case 'L':
+      parseSweep(&locks, optarg, lockByName);
+      break;
+    case 'R':
+      parseSweep(&proPrios, optarg, priorityByName);
+      proClasses = true;
+      break;
+    case 'K':
+      parseSweep(&conPrios, optarg, priorityByName);
+      conClasses = true;
+      break;
+    case 'H':
+      hogPrio = priorityByName(optarg);
+      break;
+    case 'A':
+      parseSweep(&payloads, optarg, NULL);
+      break;
+    case 'M':
+      parseSweep(&allocators, optarg, payloadByName);
+      break;
+    case 's':
+      parseSweep(&shardCounts, optarg, NULL);
+      break;
+    case 'k':
+      parseSweep(&kernels, optarg, workByName);
+      break;
+    case 'C':
+      parseSweep(&costs, optarg, NULL);
+      break;
+    case 'B':
+      parseSweep(&batches, optarg, NULL);
+      for (int i = 0; i < batches.n; i++) {
+        if (batches.values[i] > MAX_BATCH)
+          usage();
+      }
+      break;
+    case 'X':
+      crashAt = atol(optarg);
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'W':
+      warmup = atoi(optarg);
+      break;
+    case 'c':
+      pin = true;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 3 || reps < 1 || warmup < 0 || pause < 0 ||
+      deadline < 0 || startDelay < 0 || fiberWorkers < 0 || hogPrio < 0 ||
+      crashAt < 0 ||
+      (fiberWorkers > 0 &&
+       (periodic || bursts.values[0] > 0 || proClasses || conClasses ||
+        shardCounts.values[0] > 0)))
+    usage();
+  checkPriorities(&locks, proClasses ? &proPrios : NULL,
+                  conClasses ? &conPrios : NULL, hogPrio);
+  parseSweep(&loops, argv[optind], NULL);
+  parseSweep(&producers, argv[optind + 1], NULL);
+  parseSweep(&consumers, argv[optind + 2], NULL);
+
+  FILE *out = NULL;
+  bool json = false;
+  if (outPath != NULL) {
+    out = fopen(outPath, "w");
+    if (out == NULL) {
+      perror(outPath);
+      exit(1);
+    }
+    json = strlen(outPath) > 5 &&
+           strcmp(outPath + strlen(outPath) - 5, ".json") == 0;
+    if (json)
+      fprintf(out, "[");
+    else
+      fprintf(out, "queuesize,loopsize,producers,consumers,backend,wait,"
+                   "pinned,reps,itemspersec_mean,itemspersec_std,"
+                   "cputime_mean,cputime_std,latency_mean_ns,latency_std_ns,"
+                   "latency_p50_ns,latency_p99_ns,burst,pause_us,deadline_us,"
+                   "miss_ratio,lateness_mean_ns,lateness_p50_ns,"
+                   "lateness_p99_ns,lateness_max_ns,periods_us,"
+                   "start_delay_us,jitter_mean_ns,jitter_p99_ns,"
+                   "jitter_max_ns,fiber_threads,lock,hog_priority,"
+                   "payload_bytes,allocator,shards,skew_ratio,skew_p99_ns,"
+                   "skew_max_ns,kernel,cost,batch\n");
+  }
+
+  // Every combination, the last sweep changing fastest
+  enum {
+    SIZE,
+    BACKEND,
+    SHARDS,
+    WAIT,
+    LOCK,
+    PAYLOAD,
+    ALLOCATOR,
+    KERNEL,
+    COST,
+    BATCH,
+    BURST,
+    LOOP,
+    PRODUCERS,
+    CONSUMERS,
+    DIMS
+  };
+  sweep *dims[DIMS] = {&sizes,    &backends,  &shardCounts, &waits,
+                       &locks,    &payloads,  &allocators,  &kernels,
+                       &costs,    &batches,   &bursts,      &loops,
+                       &producers, &consumers};
+  int at[DIMS] = {0};
+  bool first = true;
+  for (int d = 0; d >= 0;) {
+    long v[DIMS];
+    for (int i = 0; i < DIMS; i++)
+      v[i] = dims[i]->values[at[i]];
+    runConfig c = {.queueSize = v[SIZE],
+                   .loop = v[LOOP],
+                   .producers = v[PRODUCERS],
+                   .consumers = v[CONSUMERS],
+                   .backend = v[BACKEND],
+                   .wait = v[WAIT],
+                   .pin = pin,
+                   .burst = v[BURST],
+                   .pauseUs = v[BURST] ? pause : 0,
+                   .deadlineUs = deadline,
+                   .periods = periodic ? &periods : NULL,
+                   .startDelayUs = startDelay,
+                   .fiberWorkers = fiberWorkers,
+                   .lock = v[LOCK],
+                   .proPrios = proClasses ? &proPrios : NULL,
+                   .conPrios = conClasses ? &conPrios : NULL,
+                   .hogPrio = hogPrio,
+                   .payload = v[PAYLOAD],
+                   .allocator = v[ALLOCATOR],
+                   .shards = v[SHARDS],
+                   .kernel = v[KERNEL],
+                   .cost = v[COST],
+                   .batch = v[BATCH]};
+    bool firstWait = at[WAIT] == 0, firstAllocator = at[ALLOCATOR] == 0;
+    bool firstShards = at[SHARDS] == 0;
+    for (d = DIMS - 1; d >= 0 && ++at[d] == dims[d]->n; d--)
+      at[d] = 0;
+
+    // The lanes always spin and then yield, and have no fibers, no payloads
+    // and no shards. Batches are only for one plain queue. The shm processes
+    // wait on condition variables and are plain producers and consumers.
+    // Only the locked backends have a lock protocol.
+    if (c.backend == BACKEND_LANES &&
+        (!firstWait || !firstShards || fiberWorkers || c.payload))
+      continue;
+    if (c.backend == BACKEND_SHM &&
+        (!firstWait || !firstShards || fiberWorkers || periodic ||
+         proClasses || conClasses || hogPrio || c.payload))
+      continue;
+    if (c.payload == 0 && !firstAllocator)
+      continue;
+    if (c.batch > 1 &&
+        (c.backend >= BACKEND_LANES || c.shards > 0 || fiberWorkers))
+      continue;
+    if ((c.backend != QUEUE_LOCKED && c.backend != QUEUE_EDF) &&
+        c.lock != locks.values[0])
+      continue;
+    if (c.cost == 0)
+      c.cost = workDefaultCosts[c.kernel];
+    if (c.backend >= BACKEND_LANES) {
+      c.wait = c.backend == BACKEND_SHM ? WAIT_COND : WAIT_YIELD;
+      c.shards = 0;
+    }
+    else if (c.wait < 0)
+      c.wait = queueBackends[c.backend]->defaultWait;
+
+    if (out != NULL) {
+      summarize(&c, warmup, reps, out, json, first);
+      first = false;
+      continue;
+    }
+    for (int i = 0; i < warmup + reps; i++) {
+      runResult r;
+      runOnce(&c, &r);
+      if (i >= warmup)
+        writeRun(&c, &r);
+      freeResult(&c, &r);
+    }
+  }
+
+  if (out != NULL) {
+    if (json)
+      fprintf(out, "\n]\n");
+    fclose(out);
+  }
+  TRACE_WRITE("trace.json");
 
   return 0;
 }
 
+// queueAddN adds what fits, so the rest goes in the next calls
+static void addBatch(queue *q, workFunction *items, int n) {
+  long slots[n];
+  for (int done = 0; done < n;)
+    done += queueAddN(q, items + done, n - done, slots);
+}
+
 void *producer(void *args) {
   queue *fifo;
+  workFunction item = {.work = workQueue, .arg = "Consumer is called"};
+  workFunction items[batch];
+  int n = 0;
 
   pthread_data *data = (pthread_data *)args;
+  struct timespec pause = {pauseUs / 1000000, pauseUs % 1000000 * 1000};
+  unsigned seed = data->tid + 1;
   fifo = data->q;
+  TRACE_THREAD("producer", data->tid);
 
   for (int i = 0; i < loop; i++) {
-    pthread_mutex_lock(fifo->mut);
-    while (fifo->full) {
-      printf("producer: queue FULL.\n");
-      pthread_cond_wait(fifo->notFull, fifo->mut);
+    item.value = i;
+    itemRelease(&item, monotonicNs(), &seed);
+    if (payloadSize > 0)
+      item.arg = payloadMake(fifo, i);
+    // Batches fill up, except before a pause and at the end
+    if (batch > 1) {
+      items[n++] = item;
+      if (n < batch && i < loop - 1 && (burst == 0 || (i + 1) % burst != 0))
+        continue;
     }
-    queueAdd(fifo, i);
-    pthread_mutex_unlock(fifo->mut);
-    pthread_cond_signal(fifo->notEmpty);
+    uint64_t blocked = blockStart();
+    if (data->l != NULL)
+      lanesAdd(data->l, data->tid, &item);
+    else if (data->s != NULL)
+      shardsAdd(data->s, &item, &seed);
+    else if (batch > 1)
+      addBatch(fifo, items, n);
+    else
+      queueAdd(fifo, &item);
+    n = 0;
+    blockRecord(&data->block, blocked);
+    if (burst > 0 && (i + 1) % burst == 0)
+      nanosleep(&pause, NULL);
   }
 
   return (NULL);
 }
 
+void *producerPeriodic(void *args) {
+  workFunction item = {.work = workQueue, .arg = "Consumer is called"};
+  pthread_data *data = (pthread_data *)args;
+  struct timespec next = data->start;
+  unsigned seed = data->tid + 1;
+  TRACE_THREAD("producer", data->tid);
+
+  for (int i = 0; i < loop; i++) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+      ;
+    uint64_t activation = (uint64_t)next.tv_sec * 1000000000ULL + next.tv_nsec;
+    data->jitter[i] = (int64_t)(monotonicNs() - activation);
+
+    // The job is released on its activation, not when the thread got to run
+    item.value = i;
+    itemRelease(&item, activation, &seed);
+    if (payloadSize > 0)
+      item.arg = payloadMake(data->q, i);
+    uint64_t blocked = blockStart();
+    if (data->l != NULL)
+      lanesAdd(data->l, data->tid, &item);
+    else if (data->s != NULL)
+      shardsAdd(data->s, &item, &seed);
+    else
+      queueAdd(data->q, &item);
+    blockRecord(&data->block, blocked);
+
+    next.tv_sec += data->periodUs / 1000000;
+    next.tv_nsec += data->periodUs % 1000000 * 1000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+  }
+
+  return (NULL);
+}
+
+void *producerFiber(void *args) {
+  workFunction item = {.work = workQueue, .arg = "Consumer is called"};
+  pthread_data *data = (pthread_data *)args;
+  unsigned seed = data->tid + 1;
+
+  for (int i = 0; i < loop; i++) {
+    item.value = i;
+    itemRelease(&item, monotonicNs(), &seed);
+    if (payloadSize > 0)
+      item.arg = payloadMake(fiberFifo.q, i);
+    fiberQueueAdd(&fiberFifo, &item);
+  }
+  if (atomic_fetch_sub(&fiberProducers, 1) == 1)
+    fiberQueueClose(&fiberFifo);
+
+  return (NULL);
+}
+
 void *consumer(void *args) {
   queue *fifo;
-  int d;
+  workFunction items[batch];
+  long slots[batch];
+  int n;
   pthread_data *data = (pthread_data *)args;
+  unsigned seed = data->tid + 1;
   fifo = data->q;
+  TRACE_THREAD("consumer", data->tid);
 
-  while (1) {
-    pthread_mutex_lock(fifo->mut);
-    while (fifo->empty && !areProducersFinished) {
-      printf("consumer: queue EMPTY\n");
-      pthread_cond_wait(fifo->notEmpty, fifo->mut);
-    }
-    queueDel(fifo, &d);
-    pthread_mutex_unlock(fifo->mut);
-    pthread_cond_signal(fifo->notFull);
-    if (areProducersFinished && fifo->empty)
+  for (;;) {
+    uint64_t blocked = blockStart();
+    if (batch > 1)
+      n = queueDelN(fifo, items, batch, slots);
+    else if (data->s != NULL)
+      n = (slots[0] = shardsDel(data->s, data->tid, items, &seed)) >= 0;
+    else
+      n = (slots[0] = queueDel(fifo, items)) >= 0;
+    if (n == 0)
       break;
+    blockRecord(&data->block, blocked);
+    for (int i = 0; i < n; i++) {
+      latencyRecord(&data->log, &items[i], slots[i]);
+      (items[i].work)(items[i].arg);
+      latenessRecord(&data->log, &items[i]);
+      if (payloadSize > 0)
+        queuePayloadRelease(fifo, items[i].arg);
+    }
   }
 
   printf("Consumer Finished id:%d\n", data->tid);
-  isConsumerFinished[data->tid] = true;
 
   return (NULL);
 }
 
-// returns true if all consumer threads finished
-bool areConsumersFinished(int numConThreads) {
-  bool finish = isConsumerFinished[0];
-  for (int i = 1; i < numConThreads; i++) {
-    finish = finish && isConsumerFinished[i];
+void *consumerLanes(void *args) {
+  workFunction items[LANE_BATCH];
+  long slots[LANE_BATCH];
+  int n;
+  pthread_data *data = (pthread_data *)args;
+
+  for (;;) {
+    uint64_t blocked = blockStart();
+    if ((n = lanesDel(data->l, data->tid, numConThreads, items, slots)) <= 0)
+      break;
+    blockRecord(&data->block, blocked);
+    for (int i = 0; i < n; i++) {
+      latencyRecord(&data->log, &items[i], slots[i]);
+      (items[i].work)(items[i].arg);
+      latenessRecord(&data->log, &items[i]);
+    }
   }
-  return finish;
-}
 
-queue *queueInit(int numThreads) {
-  queue *q;
+  printf("Consumer Finished id:%d\n", data->tid);
 
-  q = (queue *)malloc(sizeof(queue));
-  if (q == NULL)
-    return (NULL);
+  return (NULL);
+}
 
-  q->empty = 1;
-  q->full = 0;
-  q->head = 0;
-  q->tail = 0;
-  q->mut = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-  pthread_mutex_init(q->mut, NULL);
-  q->notFull = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
-  pthread_cond_init(q->notFull, NULL);
-  q->notEmpty = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
-  pthread_cond_init(q->notEmpty, NULL);
+// Thousands of them, so they finish without a line each
+void *consumerFiber(void *args) {
+  workFunction item;
+  long slot;
+  pthread_data *data = (pthread_data *)args;
 
-  for (int i = 0; i < QUEUESIZE; i++) {
-    q->buf[i].work = workQueue;
+  while ((slot = fiberQueueDel(&fiberFifo, &item)) >= 0) {
+    latencyRecord(&data->log, &item, slot);
+    (item.work)(item.arg);
+    latenessRecord(&data->log, &item);
+    if (payloadSize > 0)
+      queuePayloadRelease(fiberFifo.q, item.arg);
   }
 
-  return (q);
+  return (NULL);
 }
 
-void queueDelete(queue *q) {
-  pthread_cond_destroy(q->notFull);
-  free(q->notFull);
-  pthread_cond_destroy(q->notEmpty);
-  free(q->notEmpty);
-  pthread_mutex_destroy(q->mut);
-  free(q->mut);
-  free(q);
-}
+void producerProcess(const char *name, int id, int life) {
+  workFunction item = {.work = workQueue, .arg = "Consumer is called"};
+  struct timespec pause = {pauseUs / 1000000, pauseUs % 1000000 * 1000};
+  unsigned seed = id + 1 + life;
+  shmQueue *q = shmQueueOpen(name);
+  if (q == NULL) {
+    fprintf(stderr, "main: %s: no queue\n", name);
+    _exit(1);
+  }
+  if (life == 0)
+    shmQueueCrashAt(crashAt);
 
-void queueAdd(queue *q, int in) {
-  (q->buf[q->tail].work)("Producer is called");
-  q->buf[q->tail].value = in;
-  TIC(q->tail) // start counting for q->tail producer
+  // A restarted producer goes on after the last item it added
+  for (long i = shmQueueProduced(q, id); i < loop; i++) {
+    itemRelease(&item, monotonicNs(), &seed);
+    shmItem in = {i, 0, item.releaseNs, item.deadlineNs};
+    shmQueueAdd(q, id, &in);
+    if (burst > 0 && (i + 1) % burst == 0)
+      nanosleep(&pause, NULL);
+  }
 
-  printf("producer: add %d to %ld\n", in, q->tail);
+  shmQueueUnmap(q);
+}
 
-  q->tail++;
-  if (q->tail == QUEUESIZE)
-    q->tail = 0;
-  if (q->tail == q->head)
-    q->full = 1;
-  q->empty = 0;
+void consumerProcess(const char *name, int id, int life, latencyLog *log,
+                     long *len) {
+  workFunction item = {.work = workQueue, .arg = "Consumer is called"};
+  shmItem out;
+  long slot;
+  shmQueue *q = shmQueueOpen(name);
+  if (q == NULL) {
+    fprintf(stderr, "main: %s: no queue\n", name);
+    _exit(1);
+  }
+  if (life == 0)
+    shmQueueCrashAt(crashAt);
 
-  return;
+  // Only the plain data crosses the processes, the work is this one's
+  while ((slot = shmQueueDel(q, &out)) >= 0) {
+    item.value = out.value;
+    item.enqueuedNs = out.enqueuedNs;
+    item.releaseNs = out.releaseNs;
+    item.deadlineNs = out.deadlineNs;
+    latencyRecord(log, &item, slot);
+    (item.work)(item.arg);
+    latenessRecord(log, &item);
+    *len = log->len;
+  }
+
+  shmQueueUnmap(q);
 }
 
-void queueDel(queue *q, int *out) {
-  if (q->empty) {
-    printf(
-        "\033[1mThere is nothing to delete. Queue empty. Aborting\033[0m\n");
-    return;
+void *cpuHog(void *args) {
+  struct timespec idle = {0, (HOG_PERIOD_US - HOG_BUSY_US) * 1000};
+  double count = 0;
+
+  while (!atomic_load(&hogStop)) {
+    uint64_t until = monotonicNs() + HOG_BUSY_US * 1000;
+    while (monotonicNs() < until)
+      count += sin(count);
+    nanosleep(&idle, NULL);
   }
 
-  TOC(q->head) // stop counting for q->head producer
+  return count > 0 ? args : NULL;
+}
 
-  (q->buf[q->head].work)("Consumer is called");
-  *out = q->buf[q->head].value;
-  printf("consumer: received %d from %ld\n", *out, q->head);
+void itemRelease(workFunction *item, uint64_t releaseNs, unsigned *seed) {
+  item->releaseNs = releaseNs;
+  if (deadlineUs > 0)
+    item->deadlineNs =
+        releaseNs +
+        (deadlineUs / 4 + rand_r(seed) % (deadlineUs * 7 / 4 + 1)) * 1000;
+}
 
-  q->head++;
+void *payloadMake(queue *q, int value) {
+  void *payload = queuePayloadAlloc(q);
+  if (payload == NULL) {
+    fprintf(stderr, "main: Payload allocation failed.\n");
+    exit(1);
+  }
+  memset(payload, value, payloadSize);
+  return payload;
+}
 
-  if (q->head == QUEUESIZE)
-    q->head = 0;
-  if (q->head == q->tail)
-    q->empty = 1;
-  q->full = 0;
+void blockRecord(blockStats *b, uint64_t startNs) {
+  if (!timeBlocking)
+    return;
+  uint64_t ns = monotonicNs() - startNs;
+  b->ops++;
+  b->totalNs += ns;
+  if (ns > b->maxNs)
+    b->maxNs = ns;
+  b->hist[63 - __builtin_clzll(ns | 1)]++;
+}
+
+void latencyRecord(latencyLog *log, workFunction *item, long slot) {
+  uint64_t now = monotonicNs();
+  if (log->len == log->cap) {
+    log->cap *= 2;
+    log->samples = (latencySample *)realloc(log->samples,
+                                            log->cap * sizeof(latencySample));
+  }
+  log->samples[log->len].latencyNs = now - item->enqueuedNs;
+  log->samples[log->len].enqueuedNs = item->enqueuedNs;
+  log->samples[log->len].slot = slot;
+  log->samples[log->len].latenessNs = 0;
+  log->len++;
+}
 
-  return;
+void latenessRecord(latencyLog *log, workFunction *item) {
+  if (item->deadlineNs != 0)
+    log->samples[log->len - 1].latenessNs =
+        (int64_t)(monotonicNs() - item->deadlineNs);
 }
 
 void *workQueue(void *args) {
-  double count = 0;
-  for (int i = 0; i < 10; i++)
-    count += sin(i);
+  workRun(&workload);
   return NULL;
 }
 
@@ -327,3 +1598,8 @@ double diff_time(struct timespec start, struct timespec end) {
 
   return (1e9 * diff_sec + diff_nsec) / 1e9;
 }
+
+double cpuSeconds(struct rusage *usage) {
+  return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 +
+         usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
@@ -0,0 +1,632 @@
+#include "queue.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *cacheAlloc(size_t size) {
+  size = (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  void *p = aligned_alloc(CACHE_LINE, size);
+  if (p != NULL)
+    memset(p, 0, size);
+  return p;
+}
+
+RING_DEFINE(workRing, workFunction, 0, RING_LOCKED)
+
+/*
+ * Locked ring: the original queue. The ring is only touched with the mutex
+ * held, so its counters share a line, but not the one of the mutex that the
+ * waiting threads spin on.
+ */
+typedef struct {
+  pthread_mutex_t mut CACHE_ALIGNED;
+  pthread_cond_t notFull, notEmpty;
+  workRing ring CACHE_ALIGNED;
+} lockedRing;
+
+static void *lockedInit(long size, lockProtocol lock) {
+  lockedRing *r = (lockedRing *)cacheAlloc(sizeof(lockedRing));
+  if (r == NULL)
+    return (NULL);
+  if (!workRingInit(&r->ring, size)) {
+    free(r);
+    return (NULL);
+  }
+  if (mutexInit(&r->mut, lock) != 0) {
+    workRingDestroy(&r->ring);
+    free(r);
+    return (NULL);
+  }
+  pthread_cond_init(&r->notFull, NULL);
+  pthread_cond_init(&r->notEmpty, NULL);
+  return r;
+}
+
+static void lockedDestroy(void *impl) {
+  lockedRing *r = (lockedRing *)impl;
+  pthread_cond_destroy(&r->notFull);
+  pthread_cond_destroy(&r->notEmpty);
+  pthread_mutex_destroy(&r->mut);
+  workRingDestroy(&r->ring);
+  free(r);
+}
+
+// The rest are called with the mutex held
+static bool lockedFull(lockedRing *r) {
+  return workRingLen(&r->ring) == (long)r->ring.size;
+}
+
+static bool lockedEmpty(lockedRing *r) { return workRingLen(&r->ring) == 0; }
+
+// On a queue that is not full
+static long lockedPush(lockedRing *r, workFunction *in) {
+  long slot = 0;
+  workRingTryPush(&r->ring, in, &slot);
+  r->ring.buf[slot].enqueuedNs = monotonicNs();
+  return slot;
+}
+
+// On a queue that is not empty
+static long lockedPop(lockedRing *r, workFunction *out) {
+  long slot = 0;
+  workRingTryPop(&r->ring, out, &slot);
+  return slot;
+}
+
+static bool lockedTryAdd(queue *q, workFunction *in, long *slot) {
+  lockedRing *r = (lockedRing *)q->impl;
+  mutexLock(&r->mut);
+  if (lockedFull(r)) {
+    mutexUnlock(&r->mut);
+    return false;
+  }
+  *slot = lockedPush(r, in);
+  mutexUnlock(&r->mut);
+  condSignal(&r->notEmpty, false);
+  return true;
+}
+
+static bool lockedTryDel(queue *q, workFunction *out, long *slot) {
+  lockedRing *r = (lockedRing *)q->impl;
+  mutexLock(&r->mut);
+  if (lockedEmpty(r)) {
+    mutexUnlock(&r->mut);
+    return false;
+  }
+  *slot = lockedPop(r, out);
+  mutexUnlock(&r->mut);
+  condSignal(&r->notFull, false);
+  return true;
+}
+
+// One lock for the whole batch, and a broadcast when it is more than one
+static int lockedTryAddN(queue *q, workFunction *in, int n, long *slots) {
+  lockedRing *r = (lockedRing *)q->impl;
+  long first;
+  mutexLock(&r->mut);
+  int k = workRingTryPushN(&r->ring, in, n, &first);
+  uint64_t now = monotonicNs();
+  for (int i = 0; i < k; i++) {
+    slots[i] = (first + i) % q->size;
+    r->ring.buf[slots[i]].enqueuedNs = now;
+  }
+  mutexUnlock(&r->mut);
+  if (k > 0)
+    condSignal(&r->notEmpty, k > 1);
+  return k;
+}
+
+static int lockedTryDelN(queue *q, workFunction *out, int n, long *slots) {
+  lockedRing *r = (lockedRing *)q->impl;
+  long first;
+  mutexLock(&r->mut);
+  int k = workRingTryPopN(&r->ring, out, n, &first);
+  mutexUnlock(&r->mut);
+  for (int i = 0; i < k; i++)
+    slots[i] = (first + i) % q->size;
+  if (k > 0)
+    condSignal(&r->notFull, k > 1);
+  return k;
+}
+
+static long addWaiting(queue *q, workFunction *in);
+static long delWaiting(queue *q, workFunction *out);
+
+// The condition variable strategy is the ring's own condition variables
+static void lockedAdd(queue *q, workFunction *in, long *slot) {
+  lockedRing *r = (lockedRing *)q->impl;
+  if (q->notFull.strategy != WAIT_COND) {
+    *slot = addWaiting(q, in);
+    return;
+  }
+  mutexLock(&r->mut);
+  while (lockedFull(r))
+    condWait(&r->notFull, &r->mut);
+  *slot = lockedPush(r, in);
+  mutexUnlock(&r->mut);
+  condSignal(&r->notEmpty, false);
+  // A batch consumer waits on the queue's waiter instead
+  waitNotify(&q->notEmpty);
+}
+
+static bool lockedDel(queue *q, workFunction *out, long *slot) {
+  lockedRing *r = (lockedRing *)q->impl;
+  if (q->notEmpty.strategy != WAIT_COND)
+    return (*slot = delWaiting(q, out)) >= 0;
+  mutexLock(&r->mut);
+  while (lockedEmpty(r) && !atomic_load(&q->closed))
+    condWait(&r->notEmpty, &r->mut);
+  if (lockedEmpty(r)) {
+    mutexUnlock(&r->mut);
+    return false;
+  }
+  *slot = lockedPop(r, out);
+  mutexUnlock(&r->mut);
+  condSignal(&r->notFull, false);
+  waitNotify(&q->notFull);
+  return true;
+}
+
+static void lockedClose(queue *q) {
+  lockedRing *r = (lockedRing *)q->impl;
+  mutexLock(&r->mut);
+  atomic_store(&q->closed, true);
+  condSignal(&r->notEmpty, true);
+  mutexUnlock(&r->mut);
+}
+
+/*
+ * Vyukov's bounded MPMC ring, from ring.h. Every cell is on a line of its own
+ * and so are the enqueue and dequeue counters.
+ */
+RING_DEFINE(mpmcRing, workFunction, 0, RING_MPMC)
+
+static void *mpmcInit(long size, lockProtocol lock) {
+  mpmcRing *r = (mpmcRing *)cacheAlloc(sizeof(mpmcRing));
+  if (r == NULL)
+    return (NULL);
+  if (!mpmcRingInit(r, size)) {
+    free(r);
+    return (NULL);
+  }
+  return r;
+}
+
+static void mpmcDestroy(void *impl) {
+  mpmcRing *r = (mpmcRing *)impl;
+  mpmcRingDestroy(r);
+  free(r);
+}
+
+static bool mpmcTryAdd(queue *q, workFunction *in, long *slot) {
+  workFunction item = *in;
+  item.enqueuedNs = monotonicNs();
+  return mpmcRingTryPush((mpmcRing *)q->impl, &item, slot);
+}
+
+static bool mpmcTryDel(queue *q, workFunction *out, long *slot) {
+  return mpmcRingTryPop((mpmcRing *)q->impl, out, slot);
+}
+
+// Claims the run of cells with one CAS, the items are stamped in place
+static int mpmcTryAddN(queue *q, workFunction *in, int n, long *slots) {
+  long first;
+  uint64_t now = monotonicNs();
+  for (int i = 0; i < n; i++)
+    in[i].enqueuedNs = now;
+  int k = mpmcRingTryPushN((mpmcRing *)q->impl, in, n, &first);
+  for (int i = 0; i < k; i++)
+    slots[i] = (first + i) % q->size;
+  return k;
+}
+
+static int mpmcTryDelN(queue *q, workFunction *out, int n, long *slots) {
+  long first;
+  int k = mpmcRingTryPopN((mpmcRing *)q->impl, out, n, &first);
+  for (int i = 0; i < k; i++)
+    slots[i] = (first + i) % q->size;
+  return k;
+}
+
+/*
+ * Ticket ring. Producers and consumers take a ticket with one fetch_add, which
+ * never fails, and then wait for the turn of their cell: 2 * round for the
+ * producer and 2 * round + 1 for the consumer of that round. A ticket cannot
+ * be given back, so a consumer holding a ticket past the last item leaves once
+ * the queue is closed.
+ */
+typedef struct {
+  atomic_size_t turn;
+  workFunction data;
+} CACHE_ALIGNED ticketCell;
+
+typedef struct {
+  atomic_size_t tail CACHE_ALIGNED;
+  atomic_size_t head CACHE_ALIGNED;
+  ticketCell *cells CACHE_ALIGNED;
+  size_t size, mask;
+} ticketRing;
+
+static void *ticketInit(long size, lockProtocol lock) {
+  ticketRing *r = (ticketRing *)cacheAlloc(sizeof(ticketRing));
+  if (r == NULL)
+    return (NULL);
+  r->cells = (ticketCell *)cacheAlloc(size * sizeof(ticketCell));
+  if (r->cells == NULL) {
+    free(r);
+    return (NULL);
+  }
+  r->size = size;
+  r->mask = ringMask(size);
+  return r;
+}
+
+static void ticketDestroy(void *impl) {
+  ticketRing *r = (ticketRing *)impl;
+  free(r->cells);
+  free(r);
+}
+
+static inline size_t ticketTurn(ticketRing *r, size_t ticket) {
+  return 2 * (ticket / r->size);
+}
+
+// A lost CAS means another thread took the ticket, so the next one is tried
+static bool ticketTryAdd(queue *q, workFunction *in, long *slot) {
+  ticketRing *r = (ticketRing *)q->impl;
+  size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  ticketCell *cell;
+  size_t turn;
+
+  do {
+    cell = &r->cells[ringIndex(t, r->size, r->mask)];
+    turn = ticketTurn(r, t);
+    if (atomic_load_explicit(&cell->turn, memory_order_acquire) != turn)
+      return false;
+  } while (!atomic_compare_exchange_strong(&r->tail, &t, t + 1));
+  cell->data = *in;
+  cell->data.enqueuedNs = monotonicNs();
+  atomic_store_explicit(&cell->turn, turn + 1, memory_order_release);
+  *slot = cell - r->cells;
+  return true;
+}
+
+static bool ticketTryDel(queue *q, workFunction *out, long *slot) {
+  ticketRing *r = (ticketRing *)q->impl;
+  size_t t = atomic_load_explicit(&r->head, memory_order_relaxed);
+  ticketCell *cell;
+  size_t turn;
+
+  do {
+    cell = &r->cells[ringIndex(t, r->size, r->mask)];
+    turn = ticketTurn(r, t) + 1;
+    if (atomic_load_explicit(&cell->turn, memory_order_acquire) != turn)
+      return false;
+  } while (!atomic_compare_exchange_strong(&r->head, &t, t + 1));
+  *out = cell->data;
+  atomic_store_explicit(&cell->turn, turn + 1, memory_order_release);
+  *slot = cell - r->cells;
+  return true;
+}
+
+typedef struct {
+  queue *q;
+  ticketCell *cell;
+  size_t turn, ticket;
+  bool closed;
+} ticketWait;
+
+static bool ticketReady(void *arg) {
+  ticketWait *w = (ticketWait *)arg;
+  return atomic_load_explicit(&w->cell->turn, memory_order_acquire) == w->turn;
+}
+
+// After the close the tail is final, tickets past it get no item
+static bool ticketReadyOrClosed(void *arg) {
+  ticketWait *w = (ticketWait *)arg;
+  ticketRing *r = (ticketRing *)w->q->impl;
+  if (ticketReady(arg))
+    return true;
+  w->closed =
+      atomic_load(&w->q->closed) && w->ticket >= atomic_load(&r->tail);
+  return w->closed;
+}
+
+// A ticket waits for one cell, so every waiter is woken to check its own
+static void ticketAdd(queue *q, workFunction *in, long *slot) {
+  ticketRing *r = (ticketRing *)q->impl;
+  size_t t = atomic_fetch_add(&r->tail, 1);
+  ticketWait w = {q, &r->cells[ringIndex(t, r->size, r->mask)],
+                  ticketTurn(r, t), t, false};
+
+  waitFor(&q->notFull, ticketReady, &w);
+  w.cell->data = *in;
+  w.cell->data.enqueuedNs = monotonicNs();
+  atomic_store_explicit(&w.cell->turn, w.turn + 1, memory_order_release);
+  waitNotifyAll(&q->notEmpty);
+  *slot = w.cell - r->cells;
+}
+
+static bool ticketDel(queue *q, workFunction *out, long *slot) {
+  ticketRing *r = (ticketRing *)q->impl;
+  size_t t = atomic_fetch_add(&r->head, 1);
+  ticketWait w = {q, &r->cells[ringIndex(t, r->size, r->mask)],
+                  ticketTurn(r, t) + 1, t, false};
+
+  waitFor(&q->notEmpty, ticketReadyOrClosed, &w);
+  if (w.closed)
+    return false;
+  *out = w.cell->data;
+  atomic_store_explicit(&w.cell->turn, w.turn + 1, memory_order_release);
+  waitNotifyAll(&q->notFull);
+  *slot = w.cell - r->cells;
+  return true;
+}
+
+static const queueOps lockedOps = {.name = "locked",
+                                   .defaultWait = WAIT_COND,
+                                   .init = lockedInit,
+                                   .destroy = lockedDestroy,
+                                   .tryAdd = lockedTryAdd,
+                                   .tryDel = lockedTryDel,
+                                   .add = lockedAdd,
+                                   .del = lockedDel,
+                                   .close = lockedClose,
+                                   .tryAddN = lockedTryAddN,
+                                   .tryDelN = lockedTryDelN};
+static const queueOps mpmcOps = {.name = "mpmc",
+                                 .defaultWait = WAIT_YIELD,
+                                 .init = mpmcInit,
+                                 .destroy = mpmcDestroy,
+                                 .tryAdd = mpmcTryAdd,
+                                 .tryDel = mpmcTryDel,
+                                 .tryAddN = mpmcTryAddN,
+                                 .tryDelN = mpmcTryDelN};
+static const queueOps ticketOps = {.name = "ticket",
+                                   .defaultWait = WAIT_YIELD,
+                                   .init = ticketInit,
+                                   .destroy = ticketDestroy,
+                                   .tryAdd = ticketTryAdd,
+                                   .tryDel = ticketTryDel,
+                                   .add = ticketAdd,
+                                   .del = ticketDel};
+
+// In segmented.c
+extern const queueOps segmentedOps;
+// In edf.c
+extern const queueOps edfOps;
+
+const queueOps *const queueBackends[QUEUE_NUM_BACKENDS] = {
+    [QUEUE_LOCKED] = &lockedOps,
+    [QUEUE_MPMC] = &mpmcOps,
+    [QUEUE_TICKET] = &ticketOps,
+    [QUEUE_SEGMENTED] = &segmentedOps,
+    [QUEUE_EDF] = &edfOps,
+};
+
+int queueBackendByName(const char *name) {
+  for (int i = 0; i < QUEUE_NUM_BACKENDS; i++) {
+    if (strcmp(queueBackends[i]->name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+queue *queueInit(queueBackend backend, long size, int wait) {
+  return queueInitLocking(backend, size, wait, LOCK_PLAIN);
+}
+
+queue *queueInitLocking(queueBackend backend, long size, int wait,
+                        lockProtocol lock) {
+  queue *q;
+
+  q = (queue *)cacheAlloc(sizeof(queue));
+  if (q == NULL)
+    return (NULL);
+
+  q->ops = queueBackends[backend];
+  q->size = size;
+  atomic_init(&q->closed, false);
+  if (wait < 0)
+    wait = q->ops->defaultWait;
+  waiterInit(&q->notFull, wait);
+  waiterInit(&q->notEmpty, wait);
+  q->impl = q->ops->init(size, lock);
+  if (q->impl == NULL) {
+    queueDelete(q);
+    return (NULL);
+  }
+
+  return (q);
+}
+
+void queueDelete(queue *q) {
+  if (q->impl != NULL)
+    q->ops->destroy(q->impl);
+  if (q->payloads != NULL)
+    poolDelete(q->payloads);
+  waiterDestroy(&q->notFull);
+  waiterDestroy(&q->notEmpty);
+  free(q);
+}
+
+typedef struct {
+  queue *q;
+  workFunction *item;
+  long slot;
+} queueAttempt;
+
+static bool attemptAdd(void *arg) {
+  queueAttempt *a = (queueAttempt *)arg;
+  return a->q->ops->tryAdd(a->q, a->item, &a->slot);
+}
+
+// Also done once the queue is closed and drained, with slot -1
+static bool attemptDel(void *arg) {
+  queueAttempt *a = (queueAttempt *)arg;
+  if (a->q->ops->tryDel(a->q, a->item, &a->slot))
+    return true;
+  if (!atomic_load(&a->q->closed))
+    return false;
+  // Every add finished before the close, so one more try decides
+  if (!a->q->ops->tryDel(a->q, a->item, &a->slot))
+    a->slot = -1;
+  return true;
+}
+
+static long addWaiting(queue *q, workFunction *in) {
+  queueAttempt a = {q, in, -1};
+  waitFor(&q->notFull, attemptAdd, &a);
+  waitNotify(&q->notEmpty);
+  return a.slot;
+}
+
+static long delWaiting(queue *q, workFunction *out) {
+  queueAttempt a = {q, out, -1};
+  waitFor(&q->notEmpty, attemptDel, &a);
+  if (a.slot >= 0)
+    waitNotify(&q->notFull);
+  return a.slot;
+}
+
+long queueAdd(queue *q, workFunction *in) {
+  long slot;
+
+  if (q->ops->add == NULL)
+    slot = addWaiting(q, in);
+  else
+    q->ops->add(q, in, &slot);
+  TRACE_EVENT(TRACE_ENQUEUE, slot);
+  return slot;
+}
+
+long queueDel(queue *q, workFunction *out) {
+  long slot;
+
+  if (q->ops->del == NULL)
+    slot = delWaiting(q, out);
+  else if (!q->ops->del(q, out, &slot))
+    slot = -1;
+  if (slot >= 0)
+    TRACE_EVENT(TRACE_DEQUEUE, slot);
+  return slot;
+}
+
+typedef struct {
+  queue *q;
+  workFunction *items;
+  int n, done;
+  long *slots;
+} batchAttempt;
+
+static int tryAddN(queue *q, workFunction *in, int n, long *slots) {
+  int k = 0;
+  if (q->ops->tryAddN != NULL)
+    return q->ops->tryAddN(q, in, n, slots);
+  while (k < n && q->ops->tryAdd(q, &in[k], &slots[k]))
+    k++;
+  return k;
+}
+
+static int tryDelN(queue *q, workFunction *out, int n, long *slots) {
+  int k = 0;
+  if (q->ops->tryDelN != NULL)
+    return q->ops->tryDelN(q, out, n, slots);
+  while (k < n && q->ops->tryDel(q, &out[k], &slots[k]))
+    k++;
+  return k;
+}
+
+static bool attemptAddN(void *arg) {
+  batchAttempt *a = (batchAttempt *)arg;
+  a->done = tryAddN(a->q, a->items, a->n, a->slots);
+  return a->done > 0;
+}
+
+// As attemptDel, done stays 0 once the queue is closed and drained
+static bool attemptDelN(void *arg) {
+  batchAttempt *a = (batchAttempt *)arg;
+  a->done = tryDelN(a->q, a->items, a->n, a->slots);
+  if (a->done > 0 || !atomic_load(&a->q->closed))
+    return a->done > 0;
+  a->done = tryDelN(a->q, a->items, a->n, a->slots);
+  return true;
+}
+
+// A ticket waits for the turn of its own cell, so any one waiter woken for an
+// item may be the wrong one
+static void notifyBatch(queue *q, waiter *w, int k) {
+  if (k > 1 || q->ops == &ticketOps)
+    waitNotifyAll(w);
+  else if (k == 1)
+    waitNotify(w);
+}
+
+int queueAddN(queue *q, workFunction *in, int n, long *slots) {
+  batchAttempt a = {q, in, n, 0, slots};
+
+  waitFor(&q->notFull, attemptAddN, &a);
+  notifyBatch(q, &q->notEmpty, a.done);
+  for (int i = 0; i < a.done; i++)
+    TRACE_EVENT(TRACE_ENQUEUE, slots[i]);
+  return a.done;
+}
+
+int queueDelN(queue *q, workFunction *out, int n, long *slots) {
+  batchAttempt a = {q, out, n, 0, slots};
+
+  waitFor(&q->notEmpty, attemptDelN, &a);
+  notifyBatch(q, &q->notFull, a.done);
+  for (int i = 0; i < a.done; i++)
+    TRACE_EVENT(TRACE_DEQUEUE, slots[i]);
+  return a.done;
+}
+
+bool queueTryAdd(queue *q, workFunction *in, long *slot) {
+  return q->ops->tryAdd(q, in, slot);
+}
+
+bool queueTryDel(queue *q, workFunction *out, long *slot) {
+  return q->ops->tryDel(q, out, slot);
+}
+
+void queueClose(queue *q) {
+  if (q->ops->close != NULL)
+    q->ops->close(q);
+  else
+    atomic_store(&q->closed, true);
+  waitNotifyAll(&q->notEmpty);
+}
+
+const char *const payloadNames[PAYLOAD_NUM_ALLOCATORS] = {
+    [PAYLOAD_MALLOC] = "malloc",
+    [PAYLOAD_POOL] = "pool",
+};
+
+int payloadByName(const char *name) {
+  for (int i = 0; i < PAYLOAD_NUM_ALLOCATORS; i++) {
+    if (strcmp(payloadNames[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+bool queuePayloadInit(queue *q, size_t size, payloadAllocator allocator) {
+  q->payloadSize = size;
+  if (allocator == PAYLOAD_POOL)
+    q->payloads = poolInit(size);
+  return allocator != PAYLOAD_POOL || q->payloads != NULL;
+}
+
+void *queuePayloadAlloc(queue *q) {
+  return q->payloads != NULL ? poolAlloc(q->payloads) : malloc(q->payloadSize);
+}
+
+void queuePayloadRelease(queue *q, void *payload) {
+  if (q->payloads != NULL)
+    poolFree(q->payloads, payload);
+  else
+    free(payload);
+}
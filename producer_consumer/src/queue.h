@@ -0,0 +1,158 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pool.h"
+#include "ring.h"
+#include "wait.h"
+
+typedef struct {
+  void *(*work)(void *);
+  void *arg;
+  int value;
+  uint64_t enqueuedNs;   // set by the queue when the item is added
+  struct future *future; // completed by an executor worker, may be NULL
+  uint64_t releaseNs;     // when the job became ready to run
+  uint64_t deadlineNs;    // when it has to be done by, 0 for none
+} workFunction;
+
+typedef enum {
+  QUEUE_LOCKED, // mutex and two condition variables, the original ring
+  QUEUE_MPMC,   // Vyukov's bounded MPMC ring with a sequence per slot
+  QUEUE_TICKET, // ring where every operation takes a ticket and waits its turn
+  QUEUE_SEGMENTED, // unbounded list of pooled segments, size is a soft cap
+  QUEUE_EDF,       // heap that hands out the earliest deadline first
+  QUEUE_NUM_BACKENDS
+} queueBackend;
+
+typedef struct queue queue;
+
+/**
+ * A queue backend. tryAdd/tryDel never block. add/del block while the queue is
+ * full/empty; del returns false once the queue is closed and drained. The slot
+ * index of the item is returned through slot. Backends without add/del/close
+ * get ones that wait on notFull/notEmpty between tryAdd/tryDel calls.
+ * tryAddN/tryDelN move up to n items in one synchronization step and return
+ * how many; backends without them loop over tryAdd/tryDel.
+ */
+typedef struct {
+  const char *name;
+  waitStrategy defaultWait;
+  void *(*init)(long size, lockProtocol lock);
+  void (*destroy)(void *impl);
+  bool (*tryAdd)(queue *q, workFunction *in, long *slot);
+  bool (*tryDel)(queue *q, workFunction *out, long *slot);
+  void (*add)(queue *q, workFunction *in, long *slot);
+  bool (*del)(queue *q, workFunction *out, long *slot);
+  void (*close)(queue *q);
+  int (*tryAddN)(queue *q, workFunction *in, int n, long *slots);
+  int (*tryDelN)(queue *q, workFunction *out, int n, long *slots);
+} queueOps;
+
+struct queue {
+  const queueOps *ops;
+  void *impl;
+  long size;
+  atomic_bool closed;
+  waiter notFull, notEmpty;
+  size_t payloadSize;
+  payloadPool *payloads; // NULL when the payloads come from malloc
+};
+
+extern const queueOps *const queueBackends[QUEUE_NUM_BACKENDS];
+
+/**
+ * Returns the backend with that name, or -1
+ */
+int queueBackendByName(const char *name);
+
+/**
+ * wait < 0 picks the default strategy of the backend
+ */
+queue *queueInit(queueBackend backend, long size, int wait);
+
+/**
+ * As queueInit, with the protocol of the mutex of the backends that lock
+ */
+queue *queueInitLocking(queueBackend backend, long size, int wait,
+                        lockProtocol lock);
+void queueDelete(queue *q);
+
+/**
+ * Blocks while the queue is full
+ */
+long queueAdd(queue *q, workFunction *in);
+
+/**
+ * Blocks while the queue is empty. Returns -1 once the queue is closed and
+ * drained, else the slot the item was taken from.
+ */
+long queueDel(queue *q, workFunction *out);
+
+/**
+ * Batches: add as many of the n items as there is room for, blocking only
+ * while the queue is full, and return how many. The slot of every item is
+ * returned in slots.
+ */
+int queueAddN(queue *q, workFunction *in, int n, long *slots);
+
+/**
+ * Blocks while the queue is empty, then takes up to n items. Returns how
+ * many, 0 once the queue is closed and drained.
+ */
+int queueDelN(queue *q, workFunction *out, int n, long *slots);
+
+/**
+ * Never block, and leave waking the other side to the caller
+ */
+bool queueTryAdd(queue *q, workFunction *in, long *slot);
+bool queueTryDel(queue *q, workFunction *out, long *slot);
+
+/**
+ * No more items will be added. Wakes up consumers blocked on an empty queue.
+ */
+void queueClose(queue *q);
+
+typedef enum {
+  PAYLOAD_MALLOC, // malloc by the producer, free by the consumer
+  PAYLOAD_POOL,   // per-thread magazines, see pool.h
+  PAYLOAD_NUM_ALLOCATORS
+} payloadAllocator;
+
+extern const char *const payloadNames[PAYLOAD_NUM_ALLOCATORS];
+
+/**
+ * Returns the allocator with that name, or -1
+ */
+int payloadByName(const char *name);
+
+/**
+ * The items of the queue carry payloads of size bytes in their arg. Returns
+ * false when the pool can not be made.
+ */
+bool queuePayloadInit(queue *q, size_t size, payloadAllocator allocator);
+
+/**
+ * A producer allocates the payload, fills it and adds the item, and the
+ * consumer releases the payload once the item ran
+ */
+void *queuePayloadAlloc(queue *q);
+void queuePayloadRelease(queue *q, void *payload);
+
+/**
+ * Zeroed allocation aligned and padded to whole cache lines
+ */
+void *cacheAlloc(size_t size);
+
+static inline uint64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
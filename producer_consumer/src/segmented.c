@@ -0,0 +1,260 @@
+/*
+ * Unbounded queue of linked fixed size segments.
+ *
+ * Producers and consumers claim a cell of the tail/head segment with one
+ * fetch_add. A consumer that reaches a cell before its producer marks it
+ * invalid, and that producer takes another one, so nobody waits for another
+ * thread inside a segment. The producer that overflows the tail segment links
+ * the next one, and the consumer that drains the head segment unlinks it.
+ *
+ * Unlinked segments go back to a free list once the last thread that may
+ * still hold a pointer to them lets go, so steady state traffic does not
+ * malloc. Segments are never freed before the queue, so a stale pointer can
+ * still count itself in and out of refs before it finds out it is stale.
+ *
+ * The size given to the queue is a soft cap: no new segment is linked while
+ * the linked segments hold that many items, so a queue can go over it by the
+ * segments producers are linking concurrently. Unlinking a segment is what
+ * makes room, so the consumer that does it wakes the producers.
+ */
+#include <stdlib.h>
+
+#include "queue.h"
+
+#define SEGMENT_CELLS 64
+// Unlinked segments that threads still pin on top of the linked ones
+#define SEGMENT_SLACK 256
+
+#define CELL_EMPTY 0
+#define CELL_FULL 1
+#define CELL_INVALID 2 // a consumer got here first
+
+typedef struct {
+  atomic_uint state;
+  workFunction data;
+} CACHE_ALIGNED segmentCell;
+
+typedef struct segment {
+  atomic_size_t enqueueIdx CACHE_ALIGNED;
+  atomic_size_t dequeueIdx CACHE_ALIGNED;
+  _Atomic(struct segment *) next CACHE_ALIGNED;
+  atomic_int refs;    // threads that may be using the segment
+  atomic_int retired; // 1 once unlinked, 2 once back in the pool
+  int index;          // in segmentQueue.segments
+  segmentCell cells[SEGMENT_CELLS];
+} segment;
+
+typedef struct {
+  _Atomic(segment *) head CACHE_ALIGNED;
+  _Atomic(segment *) tail CACHE_ALIGNED;
+  // Free list of segment indices. The upper half counts the pushes, so a pop
+  // that read a stale top fails its CAS instead of corrupting the list.
+  atomic_uint_fast64_t freeTop CACHE_ALIGNED;
+  atomic_int live; // linked segments
+  atomic_int allocated;
+  int cap, maxSegments;
+  segment **segments;
+  atomic_int *freeNext; // index + 1 of the next free segment, 0 ends the list
+} segmentQueue;
+
+static void poolPush(segmentQueue *s, segment *seg) {
+  uint_fast64_t top = atomic_load(&s->freeTop), next;
+  do {
+    atomic_store(&s->freeNext[seg->index], (int)(top & 0xffffffff));
+    next = ((top >> 32) + 1) << 32 | (uint_fast64_t)(seg->index + 1);
+  } while (!atomic_compare_exchange_weak(&s->freeTop, &top, next));
+}
+
+static segment *poolPop(segmentQueue *s) {
+  uint_fast64_t top = atomic_load(&s->freeTop), next;
+  int index;
+  do {
+    if ((top & 0xffffffff) == 0)
+      return (NULL);
+    index = (int)(top & 0xffffffff) - 1;
+    next = (top & ~(uint_fast64_t)0xffffffff) |
+           (uint_fast64_t)atomic_load(&s->freeNext[index]);
+  } while (!atomic_compare_exchange_weak(&s->freeTop, &top, next));
+  return s->segments[index];
+}
+
+// Returns NULL once the linked segments reach the cap
+static segment *segmentTake(segmentQueue *s) {
+  if (atomic_load(&s->live) >= s->cap)
+    return (NULL);
+
+  segment *seg = poolPop(s);
+  if (seg == NULL) {
+    int index = atomic_fetch_add(&s->allocated, 1);
+    if (index >= s->maxSegments) {
+      atomic_fetch_sub(&s->allocated, 1);
+      return (NULL);
+    }
+    seg = (segment *)cacheAlloc(sizeof(segment));
+    if (seg == NULL) {
+      atomic_fetch_sub(&s->allocated, 1);
+      return (NULL);
+    }
+    seg->index = index;
+    s->segments[index] = seg;
+  }
+
+  // refs is left alone, stale threads may still be counting themselves out
+  atomic_store(&seg->enqueueIdx, 0);
+  atomic_store(&seg->dequeueIdx, 0);
+  atomic_store(&seg->next, NULL);
+  atomic_store(&seg->retired, 0);
+  for (int i = 0; i < SEGMENT_CELLS; i++)
+    atomic_store_explicit(&seg->cells[i].state, CELL_EMPTY,
+                          memory_order_relaxed);
+  atomic_fetch_add(&s->live, 1);
+  return seg;
+}
+
+static void segmentRelease(segmentQueue *s, segment *seg) {
+  int unlinked = 1;
+  if (atomic_fetch_sub(&seg->refs, 1) == 1 &&
+      atomic_compare_exchange_strong(&seg->retired, &unlinked, 2))
+    poolPush(s, seg);
+}
+
+// Pins the segment *ptr points to, so it is not recycled under us
+static segment *segmentAcquire(segmentQueue *s, _Atomic(segment *) *ptr) {
+  for (;;) {
+    segment *seg = atomic_load(ptr);
+    atomic_fetch_add(&seg->refs, 1);
+    if (atomic_load(ptr) == seg)
+      return seg;
+    segmentRelease(s, seg);
+  }
+}
+
+static void *segmentedInit(long size, lockProtocol lock) {
+  segmentQueue *s = (segmentQueue *)cacheAlloc(sizeof(segmentQueue));
+  if (s == NULL)
+    return (NULL);
+
+  s->cap = (size + SEGMENT_CELLS - 1) / SEGMENT_CELLS;
+  if (s->cap < 2)
+    s->cap = 2;
+  s->maxSegments = s->cap + SEGMENT_SLACK;
+  s->segments = (segment **)calloc(s->maxSegments, sizeof(segment *));
+  s->freeNext = (atomic_int *)calloc(s->maxSegments, sizeof(atomic_int));
+  segment *first = s->segments && s->freeNext ? segmentTake(s) : NULL;
+  if (first == NULL) {
+    free(s->segments);
+    free(s->freeNext);
+    free(s);
+    return (NULL);
+  }
+  atomic_store(&s->head, first);
+  atomic_store(&s->tail, first);
+  return s;
+}
+
+static void segmentedDestroy(void *impl) {
+  segmentQueue *s = (segmentQueue *)impl;
+  for (int i = 0; i < atomic_load(&s->allocated); i++)
+    free(s->segments[i]);
+  free(s->segments);
+  free(s->freeNext);
+  free(s);
+}
+
+static bool segmentedTryAdd(queue *q, workFunction *in, long *slot) {
+  segmentQueue *s = (segmentQueue *)q->impl;
+
+  for (;;) {
+    segment *seg = segmentAcquire(s, &s->tail);
+    size_t i = atomic_fetch_add(&seg->enqueueIdx, 1);
+
+    if (i < SEGMENT_CELLS) {
+      segmentCell *cell = &seg->cells[i];
+      unsigned empty = CELL_EMPTY;
+      cell->data = *in;
+      cell->data.enqueuedNs = monotonicNs();
+      if (atomic_compare_exchange_strong(&cell->state, &empty, CELL_FULL)) {
+        *slot = (long)seg->index * SEGMENT_CELLS + i;
+        segmentRelease(s, seg);
+        return true;
+      }
+      segmentRelease(s, seg);
+      continue;
+    }
+
+    // The tail segment is full, link the next one if nobody did yet
+    segment *next = atomic_load(&seg->next);
+    if (next == NULL) {
+      segment *fresh = segmentTake(s);
+      if (fresh == NULL) {
+        segmentRelease(s, seg);
+        return false; // at the cap
+      }
+      if (atomic_compare_exchange_strong(&seg->next, &next, fresh))
+        next = fresh;
+      else {
+        atomic_fetch_sub(&s->live, 1);
+        poolPush(s, fresh);
+      }
+    }
+    segment *expected = seg;
+    atomic_compare_exchange_strong(&s->tail, &expected, next);
+    segmentRelease(s, seg);
+  }
+}
+
+static bool segmentedTryDel(queue *q, workFunction *out, long *slot) {
+  segmentQueue *s = (segmentQueue *)q->impl;
+
+  for (;;) {
+    segment *seg = segmentAcquire(s, &s->head);
+    size_t d = atomic_load(&seg->dequeueIdx);
+
+    if (d >= SEGMENT_CELLS) {
+      // Drained, unlink it once there is a next one
+      segment *next = atomic_load(&seg->next);
+      if (next == NULL) {
+        segmentRelease(s, seg);
+        return false;
+      }
+      segment *expected = seg;
+      atomic_compare_exchange_strong(&s->tail, &expected, next);
+      expected = seg;
+      if (atomic_compare_exchange_strong(&s->head, &expected, next)) {
+        atomic_store(&seg->retired, 1);
+        atomic_fetch_sub(&s->live, 1);
+        waitNotifyAll(&q->notFull);
+      }
+      segmentRelease(s, seg);
+      continue;
+    }
+    if (d >= atomic_load(&seg->enqueueIdx)) {
+      segmentRelease(s, seg);
+      return false; // empty
+    }
+
+    size_t i = atomic_fetch_add(&seg->dequeueIdx, 1);
+    if (i >= SEGMENT_CELLS) {
+      segmentRelease(s, seg);
+      continue;
+    }
+    segmentCell *cell = &seg->cells[i];
+    unsigned empty = CELL_EMPTY;
+    // Its producer claimed the cell but did not fill it yet, so it retries
+    if (atomic_compare_exchange_strong(&cell->state, &empty, CELL_INVALID)) {
+      segmentRelease(s, seg);
+      continue;
+    }
+    *out = cell->data;
+    *slot = (long)seg->index * SEGMENT_CELLS + i;
+    segmentRelease(s, seg);
+    return true;
+  }
+}
+
+const queueOps segmentedOps = {.name = "segmented",
+                               .defaultWait = WAIT_YIELD,
+                               .init = segmentedInit,
+                               .destroy = segmentedDestroy,
+                               .tryAdd = segmentedTryAdd,
+                               .tryDel = segmentedTryDel};
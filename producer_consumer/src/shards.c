@@ -0,0 +1,149 @@
+#include "shards.h"
+
+#include <stdlib.h>
+
+shards *shardsInit(int numShards, queueBackend backend, long size, int wait,
+                   lockProtocol lock) {
+  shards *s;
+
+  s = (shards *)malloc(sizeof(shards));
+  if (s == NULL)
+    return (NULL);
+  s->shards = (shard *)cacheAlloc(numShards * sizeof(shard));
+  if (s->shards == NULL) {
+    free(s);
+    return (NULL);
+  }
+  s->numShards = numShards;
+  s->size = size;
+  atomic_init(&s->closed, false);
+  if (wait < 0)
+    wait = queueBackends[backend]->defaultWait;
+  waiterInit(&s->notFull, wait);
+  waiterInit(&s->notEmpty, wait);
+
+  // The shards only see try operations, the waiting happens here
+  for (int i = 0; i < numShards; i++) {
+    s->shards[i].q = queueInitLocking(backend, size, wait, lock);
+    if (s->shards[i].q == NULL) {
+      shardsDelete(s);
+      return (NULL);
+    }
+  }
+
+  return (s);
+}
+
+void shardsDelete(shards *s) {
+  for (int i = 0; i < s->numShards; i++) {
+    if (s->shards[i].q != NULL)
+      queueDelete(s->shards[i].q);
+  }
+  waiterDestroy(&s->notFull);
+  waiterDestroy(&s->notEmpty);
+  free(s->shards);
+  free(s);
+}
+
+typedef struct {
+  shards *s;
+  workFunction *item;
+  unsigned *seed;
+  int home;
+  long slot;
+} shardsAttempt;
+
+static long shardLen(shards *s, int i) {
+  return atomic_load_explicit(&s->shards[i].len, memory_order_relaxed);
+}
+
+// Two different random shards, the one with fewer items first when fewest
+static void choose(shardsAttempt *a, int *first, int *second, bool fewest) {
+  int k = a->s->numShards;
+
+  *first = rand_r(a->seed) % k;
+  *second = k > 1 ? (*first + 1 + rand_r(a->seed) % (k - 1)) % k : *first;
+  if ((shardLen(a->s, *second) < shardLen(a->s, *first)) == fewest) {
+    int t = *first;
+    *first = *second;
+    *second = t;
+  }
+}
+
+static bool tryAdd(shardsAttempt *a, int i) {
+  shard *sh = &a->s->shards[i];
+  if (!queueTryAdd(sh->q, a->item, &a->slot))
+    return false;
+  atomic_fetch_add_explicit(&sh->len, 1, memory_order_relaxed);
+  a->slot += i * a->s->size;
+  return true;
+}
+
+static bool tryDel(shardsAttempt *a, int i) {
+  shard *sh = &a->s->shards[i];
+  if (!queueTryDel(sh->q, a->item, &a->slot))
+    return false;
+  atomic_fetch_sub_explicit(&sh->len, 1, memory_order_relaxed);
+  a->slot += i * a->s->size;
+  return true;
+}
+
+static bool attemptAdd(void *arg) {
+  shardsAttempt *a = (shardsAttempt *)arg;
+  int first, second;
+
+  choose(a, &first, &second, true);
+  return tryAdd(a, first) || (second != first && tryAdd(a, second));
+}
+
+// Every shard, so that an item in a shard nobody sampled is not left behind
+static bool sweep(shardsAttempt *a) {
+  for (int i = 1; i <= a->s->numShards; i++) {
+    if (tryDel(a, (a->home + i) % a->s->numShards))
+      return true;
+  }
+  return false;
+}
+
+// Also done once the shards are closed and drained, with slot -1
+static bool attemptDel(void *arg) {
+  shardsAttempt *a = (shardsAttempt *)arg;
+  int first, second;
+
+  if (tryDel(a, a->home))
+    return true;
+  choose(a, &first, &second, false);
+  if (tryDel(a, first) || (second != first && tryDel(a, second)) || sweep(a))
+    return true;
+  if (!atomic_load(&a->s->closed))
+    return false;
+  // Every add finished before the close, so one more sweep decides
+  if (!sweep(a))
+    a->slot = -1;
+  return true;
+}
+
+long shardsAdd(shards *s, workFunction *in, unsigned *seed) {
+  shardsAttempt a = {s, in, seed, 0, -1};
+
+  waitFor(&s->notFull, attemptAdd, &a);
+  waitNotify(&s->notEmpty);
+  TRACE_EVENT(TRACE_ENQUEUE, a.slot);
+  return a.slot;
+}
+
+long shardsDel(shards *s, int home, workFunction *out, unsigned *seed) {
+  shardsAttempt a = {s, out, seed, home % s->numShards, -1};
+
+  waitFor(&s->notEmpty, attemptDel, &a);
+  if (a.slot >= 0) {
+    waitNotify(&s->notFull);
+    TRACE_EVENT(TRACE_DEQUEUE, a.slot);
+  }
+  return a.slot;
+}
+
+void shardsClose(shards *s) {
+  atomic_store(&s->closed, true);
+  waitNotifyAll(&s->notEmpty);
+}
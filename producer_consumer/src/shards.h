@@ -0,0 +1,56 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include "queue.h"
+
+/**
+ * K independent queues of one backend instead of one shared queue. A producer
+ * adds to the shorter of two random shards and a consumer takes from its home
+ * shard, shard id % K, then from the longer of two random shards and, only
+ * when those are empty too, looks at every shard before it waits.
+ *
+ * Items of one shard leave in order, but there is no order across shards: an
+ * item can be taken after items that were added later to another shard. The
+ * benchmark measures how much later as the ordering skew of every item. The
+ * lengths the choices compare are counters next to each shard, updated after
+ * every add and take, so they may be off by the operations in flight.
+ */
+typedef struct {
+  queue *q;
+  atomic_long len CACHE_ALIGNED;
+} shard;
+
+typedef struct {
+  shard *shards;
+  int numShards;
+  long size;
+  atomic_bool closed;
+  waiter notFull, notEmpty;
+} shards;
+
+/**
+ * Every shard is a queue of backend with size slots. wait < 0 picks the
+ * default strategy of the backend.
+ */
+shards *shardsInit(int numShards, queueBackend backend, long size, int wait,
+                   lockProtocol lock);
+void shardsDelete(shards *s);
+
+/**
+ * Blocks while both chosen shards are full. Returns shard * size + the slot of
+ * the item.
+ */
+long shardsAdd(shards *s, workFunction *in, unsigned *seed);
+
+/**
+ * Blocks while every shard is empty. Returns -1 once the shards are closed and
+ * drained, else the slot as in shardsAdd.
+ */
+long shardsDel(shards *s, int home, workFunction *out, unsigned *seed);
+
+/**
+ * The producers are done. Consumers drain the shards and then get -1.
+ */
+void shardsClose(shards *s);
+
+#endif
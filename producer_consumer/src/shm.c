@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+
+#include "shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "queue.h"
+
+// Longest wait before a waiter looks at the ring again
+#define SHM_WAIT_NS 10000000L
+
+/*
+ * The add a producer is in the middle of: its count before the add and the
+ * tail it publishes the item at. producer is -1 when there is none.
+ */
+typedef struct {
+  int producer;
+  long produced;
+  size_t tail;
+} shmRedo;
+
+/*
+ * The region: this header, the count of every producer and then the ring.
+ * Everything is at the same offset in every process.
+ */
+struct shmQueue {
+  size_t bytes;
+  pthread_mutex_t mut;
+  pthread_cond_t notFull, notEmpty;
+  size_t head, tail, size, mask;
+  bool closed;
+  shmRedo redo;
+  long recoveries;
+  int producers;
+};
+
+static long crashAt;
+
+static long *shmProduced(shmQueue *q) { return (long *)(q + 1); }
+
+static shmItem *shmItems(shmQueue *q) {
+  return (shmItem *)(shmProduced(q) + q->producers);
+}
+
+static shmQueue *shmMap(int fd, size_t bytes) {
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return p == MAP_FAILED ? NULL : (shmQueue *)p;
+}
+
+shmQueue *shmQueueCreate(const char *name, long size, int producers) {
+  size_t bytes = sizeof(shmQueue) + producers * sizeof(long) +
+                 size * sizeof(shmItem);
+  pthread_mutexattr_t mutAttr;
+  pthread_condattr_t condAttr;
+  shmQueue *q;
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    return (NULL);
+  if (ftruncate(fd, bytes) != 0 || (q = shmMap(fd, bytes)) == NULL) {
+    shm_unlink(name);
+    return (NULL);
+  }
+
+  // ftruncate zeroed the counts and the ring
+  q->bytes = bytes;
+  q->size = size;
+  q->mask = ringMask(size);
+  q->producers = producers;
+  q->redo.producer = -1;
+  pthread_mutexattr_init(&mutAttr);
+  pthread_mutexattr_setpshared(&mutAttr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutAttr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&q->mut, &mutAttr);
+  pthread_mutexattr_destroy(&mutAttr);
+  pthread_condattr_init(&condAttr);
+  pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+  pthread_cond_init(&q->notFull, &condAttr);
+  pthread_cond_init(&q->notEmpty, &condAttr);
+  pthread_condattr_destroy(&condAttr);
+  return q;
+}
+
+shmQueue *shmQueueOpen(const char *name) {
+  struct stat st;
+
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return (NULL);
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(shmQueue)) {
+    close(fd);
+    return (NULL);
+  }
+  return shmMap(fd, st.st_size);
+}
+
+void shmQueueUnmap(shmQueue *q) { munmap(q, q->bytes); }
+
+void shmQueueUnlink(const char *name) { shm_unlink(name); }
+
+// The owner died between the stores of an add or a del. Only an add that
+// published its item can have left its count behind.
+static void shmRecover(shmQueue *q) {
+  if (q->redo.producer >= 0 && q->tail != q->redo.tail)
+    shmProduced(q)[q->redo.producer] = q->redo.produced + 1;
+  q->redo.producer = -1;
+  q->recoveries++;
+  pthread_mutex_consistent(&q->mut);
+}
+
+static void shmLock(shmQueue *q) {
+  if (pthread_mutex_lock(&q->mut) == EOWNERDEAD)
+    shmRecover(q);
+}
+
+static void shmWait(shmQueue *q, pthread_cond_t *cond) {
+  struct timespec until;
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  until.tv_nsec += SHM_WAIT_NS;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  if (pthread_cond_timedwait(cond, &q->mut, &until) == EOWNERDEAD)
+    shmRecover(q);
+}
+
+// Keeps the compiler from moving the stores of an operation past the one
+// that publishes it, where a kill could catch them
+static inline void shmOrder() { atomic_signal_fence(memory_order_seq_cst); }
+
+static void shmCrash() {
+  if (crashAt > 0 && --crashAt == 0)
+    raise(SIGKILL);
+}
+
+long shmQueueAdd(shmQueue *q, int producer, shmItem *in) {
+  shmLock(q);
+  while (q->tail - q->head == q->size)
+    shmWait(q, &q->notFull);
+  long slot = ringIndex(q->tail, q->size, q->mask);
+  shmItems(q)[slot] = *in;
+  shmItems(q)[slot].enqueuedNs = monotonicNs();
+  q->redo.produced = shmProduced(q)[producer];
+  q->redo.tail = q->tail;
+  shmOrder();
+  q->redo.producer = producer;
+  shmOrder();
+  q->tail++;
+  shmOrder();
+  shmCrash();
+  shmProduced(q)[producer]++;
+  shmOrder();
+  q->redo.producer = -1;
+  pthread_mutex_unlock(&q->mut);
+  pthread_cond_signal(&q->notEmpty);
+  return slot;
+}
+
+long shmQueueDel(shmQueue *q, shmItem *out) {
+  shmLock(q);
+  while (q->tail == q->head && !q->closed)
+    shmWait(q, &q->notEmpty);
+  if (q->tail == q->head) {
+    pthread_mutex_unlock(&q->mut);
+    return -1;
+  }
+  long slot = ringIndex(q->head, q->size, q->mask);
+  *out = shmItems(q)[slot];
+  shmOrder();
+  shmCrash();
+  q->head++;
+  pthread_mutex_unlock(&q->mut);
+  pthread_cond_signal(&q->notFull);
+  return slot;
+}
+
+void shmQueueClose(shmQueue *q) {
+  shmLock(q);
+  q->closed = true;
+  pthread_mutex_unlock(&q->mut);
+  pthread_cond_broadcast(&q->notEmpty);
+}
+
+long shmQueueProduced(shmQueue *q, int producer) {
+  shmLock(q);
+  long produced = shmProduced(q)[producer];
+  pthread_mutex_unlock(&q->mut);
+  return produced;
+}
+
+long shmQueueRecoveries(shmQueue *q) {
+  shmLock(q);
+  long recoveries = q->recoveries;
+  pthread_mutex_unlock(&q->mut);
+  return recoveries;
+}
+
+void shmQueueCrashAt(long ops) { crashAt = ops; }
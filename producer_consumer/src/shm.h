@@ -0,0 +1,76 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Bounded FIFO in a shm_open region, shared by producer and consumer
+ * processes that each map it on their own, so the region holds no pointers.
+ * A robust process-shared mutex guards the ring and two process-shared
+ * condition variables wait on it.
+ *
+ * A process that dies holding the mutex hands it to the next locker with
+ * EOWNERDEAD. Every operation publishes with its last store, the tail of an
+ * add and the head of a del, so the ring is either before or after the
+ * operation; an add also logs its producer's count first, so the next locker
+ * can finish it. A restarted producer goes on from shmQueueProduced. Waits are
+ * timed, since a process killed while waiting can swallow a wakeup.
+ */
+typedef struct {
+  int value;
+  uint64_t enqueuedNs; // set by the queue when the item is added
+  uint64_t releaseNs;
+  uint64_t deadlineNs;
+} shmItem;
+
+typedef struct shmQueue shmQueue;
+
+/**
+ * Creates the region name with size slots for producers producers, mapped.
+ * Returns NULL if it can not be made.
+ */
+shmQueue *shmQueueCreate(const char *name, long size, int producers);
+
+/**
+ * Maps the region name another process created, NULL if there is none
+ */
+shmQueue *shmQueueOpen(const char *name);
+void shmQueueUnmap(shmQueue *q);
+void shmQueueUnlink(const char *name);
+
+/**
+ * Blocks while the queue is full. Returns the slot of the item.
+ */
+long shmQueueAdd(shmQueue *q, int producer, shmItem *in);
+
+/**
+ * Blocks while the queue is empty. Returns -1 once the queue is closed and
+ * drained, else the slot the item was taken from.
+ */
+long shmQueueDel(shmQueue *q, shmItem *out);
+
+/**
+ * No more items will be added
+ */
+void shmQueueClose(shmQueue *q);
+
+/**
+ * Items producer added so far, counting the add of a producer that died
+ * after it published the item
+ */
+long shmQueueProduced(shmQueue *q, int producer);
+
+/**
+ * Times a process found the mutex of a dead owner
+ */
+long shmQueueRecoveries(shmQueue *q);
+
+/**
+ * Crash injection: the calling process kills itself in the middle of its
+ * ops-th add or del from now, holding the mutex, after the item is published
+ * by an add and before it is by a del. 0 never does.
+ */
+void shmQueueCrashAt(long ops);
+
+#endif
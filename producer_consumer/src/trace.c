@@ -0,0 +1,126 @@
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  uint64_t ns;
+  uint32_t type;
+  int32_t arg;
+} traceRecord;
+
+typedef struct traceBuffer {
+  struct traceBuffer *next; // every buffer, newest first
+  int tid;
+  char name[32];
+  long len, dropped;
+  traceRecord events[TRACE_EVENTS];
+} traceBuffer;
+
+static _Atomic(traceBuffer *) buffers;
+static atomic_int threads;
+static _Thread_local traceBuffer *self;
+
+static const char *const eventNames[TRACE_NUM_EVENTS] = {
+    [TRACE_ENQUEUE] = "enqueue",     [TRACE_DEQUEUE] = "dequeue",
+    [TRACE_WAIT_START] = "wait",     [TRACE_WAIT_END] = "wait",
+    [TRACE_SIGNAL] = "signal",       [TRACE_LOCK_ACQUIRE] = "lock held",
+    [TRACE_LOCK_RELEASE] = "lock held",
+};
+
+// The first event of a thread allocates its buffer and links it in
+static traceBuffer *traceBufferGet() {
+  if (self != NULL)
+    return self;
+
+  traceBuffer *b = (traceBuffer *)malloc(sizeof(traceBuffer));
+  if (b == NULL)
+    return (NULL);
+  b->tid = atomic_fetch_add(&threads, 1);
+  snprintf(b->name, sizeof(b->name), "thread %d", b->tid);
+  b->len = b->dropped = 0;
+  b->next = atomic_load(&buffers);
+  while (!atomic_compare_exchange_weak(&buffers, &b->next, b))
+    ;
+  self = b;
+  return b;
+}
+
+void traceEvent(traceEventType type, long arg) {
+  traceBuffer *b = traceBufferGet();
+  if (b == NULL)
+    return;
+  if (b->len == TRACE_EVENTS) {
+    b->dropped++;
+    return;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  traceRecord *e = &b->events[b->len++];
+  e->ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  e->type = type;
+  e->arg = (int32_t)arg;
+}
+
+void traceThread(const char *name, int id) {
+  traceBuffer *b = traceBufferGet();
+  if (b != NULL)
+    snprintf(b->name, sizeof(b->name), "%s %d", name, id);
+}
+
+int traceWrite(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  // Timestamps in us from the first event
+  uint64_t origin = UINT64_MAX;
+  for (traceBuffer *b = atomic_load(&buffers); b != NULL; b = b->next) {
+    if (b->len > 0 && b->events[0].ns < origin)
+      origin = b->events[0].ns;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  bool first = true;
+  for (traceBuffer *b = atomic_load(&buffers); b != NULL; b = b->next) {
+    fprintf(out,
+            "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": %d, \"args\": {\"name\": \"%s\", \"dropped\": %ld}}",
+            first ? "" : ",\n", b->tid, b->name, b->dropped);
+    first = false;
+    for (long i = 0; i < b->len; i++) {
+      traceRecord *e = &b->events[i];
+      const char *ph;
+      switch (e->type) {
+      case TRACE_WAIT_START:
+      case TRACE_LOCK_ACQUIRE:
+        ph = "B";
+        break;
+      case TRACE_WAIT_END:
+      case TRACE_LOCK_RELEASE:
+        ph = "E";
+        break;
+      default:
+        ph = "i";
+      }
+      fprintf(out,
+              ",\n{\"name\": \"%s\", \"ph\": \"%s\", \"s\": \"t\", "
+              "\"ts\": %.3f, \"pid\": 1, \"tid\": %d, "
+              "\"args\": {\"arg\": %d}}",
+              eventNames[e->type], ph, (e->ns - origin) / 1e3, b->tid,
+              e->arg);
+    }
+  }
+  fprintf(out, "\n]}\n");
+
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Event tracer, built only with -DTRACE (make trace). Without it the macros
+ * expand to nothing and trace.c is not linked, so benchmark builds carry no
+ * trace code at all.
+ *
+ * Every thread appends fixed size binary events with a CLOCK_MONOTONIC
+ * timestamp to a buffer of its own, so recording takes no lock and no atomic
+ * operation. The buffers outlive their threads, and TRACE_WRITE turns all of
+ * them into Chrome trace JSON that Perfetto and chrome://tracing open.
+ */
+typedef enum {
+  TRACE_ENQUEUE,      // arg is the slot
+  TRACE_DEQUEUE,      // arg is the slot
+  TRACE_WAIT_START,   // the thread blocks on a full or empty queue
+  TRACE_WAIT_END,
+  TRACE_SIGNAL,       // a sleeper may be woken
+  TRACE_LOCK_ACQUIRE, // the queue mutex is held until the release
+  TRACE_LOCK_RELEASE,
+  TRACE_NUM_EVENTS
+} traceEventType;
+
+#ifdef TRACE
+
+// Events a thread keeps, the later ones are counted and dropped
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS (64 * 1024)
+#endif
+
+void traceEvent(traceEventType type, long arg);
+
+/**
+ * Names the calling thread in the trace, e.g. "producer" and 3
+ */
+void traceThread(const char *name, int id);
+
+/**
+ * Writes every event recorded so far. Returns -1 if the file can not be
+ * written.
+ */
+int traceWrite(const char *path);
+
+#define TRACE_EVENT(type, arg) traceEvent(type, arg)
+#define TRACE_THREAD(name, id) traceThread(name, id)
+#define TRACE_WRITE(path) traceWrite(path)
+
+#else
+
+#define TRACE_EVENT(type, arg) ((void)0)
+#define TRACE_THREAD(name, id) ((void)0)
+#define TRACE_WRITE(path) ((void)0)
+
+#endif
+
+#endif
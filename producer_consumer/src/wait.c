@@ -0,0 +1,161 @@
+#include "wait.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *const waitNames[WAIT_NUM_STRATEGIES] = {
+    [WAIT_SPIN] = "spin",
+    [WAIT_YIELD] = "yield",
+    [WAIT_FUTEX] = "futex",
+    [WAIT_COND] = "cond",
+};
+
+int waitByName(const char *name) {
+  for (int i = 0; i < WAIT_NUM_STRATEGIES; i++) {
+    if (strcmp(waitNames[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+const char *const lockNames[LOCK_NUM_PROTOCOLS] = {
+    [LOCK_PLAIN] = "plain",
+    [LOCK_INHERIT] = "inherit",
+    [LOCK_PROTECT] = "protect",
+};
+
+int lockByName(const char *name) {
+  for (int i = 0; i < LOCK_NUM_PROTOCOLS; i++) {
+    if (strcmp(lockNames[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+int mutexInit(pthread_mutex_t *mut, lockProtocol lock) {
+  pthread_mutexattr_t attr;
+  int rc;
+
+  if (lock == LOCK_PLAIN)
+    return pthread_mutex_init(mut, NULL);
+  pthread_mutexattr_init(&attr);
+  if (lock == LOCK_INHERIT) {
+    rc = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+  } else {
+    rc = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT);
+    if (rc == 0)
+      rc = pthread_mutexattr_setprioceiling(
+          &attr, sched_get_priority_max(SCHED_FIFO));
+  }
+  if (rc == 0)
+    rc = pthread_mutex_init(mut, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return rc;
+}
+
+void futexWait(atomic_uint *addr, unsigned val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void futexWake(atomic_uint *addr, int n) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+void waiterInit(waiter *w, waitStrategy strategy) {
+  atomic_init(&w->seq, 0);
+  atomic_init(&w->waiters, 0);
+  w->strategy = strategy;
+  pthread_mutex_init(&w->mut, NULL);
+  pthread_cond_init(&w->cond, NULL);
+}
+
+void waiterDestroy(waiter *w) {
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->mut);
+}
+
+// Sleeps until seq moves past the value read before the last attempt
+static void sleepOn(waiter *w, unsigned seq) {
+  if (w->strategy == WAIT_FUTEX) {
+    futexWait(&w->seq, seq);
+    return;
+  }
+  pthread_mutex_lock(&w->mut);
+  while (atomic_load(&w->seq) == seq)
+    pthread_cond_wait(&w->cond, &w->mut);
+  pthread_mutex_unlock(&w->mut);
+}
+
+void waitFor(waiter *w, bool (*attempt)(void *), void *arg) {
+  int spins = 0;
+
+  if (attempt(arg))
+    return;
+  TRACE_EVENT(TRACE_WAIT_START, w->strategy);
+  do {
+    switch (w->strategy) {
+    case WAIT_SPIN:
+      cpuRelax();
+      continue;
+    case WAIT_YIELD:
+      backoff(&spins);
+      continue;
+    case WAIT_FUTEX:
+      if (++spins < SPIN_LIMIT) {
+        cpuRelax();
+        continue;
+      }
+      break;
+    default:
+      break;
+    }
+
+    // Count in before the last attempt, so a notifier either sees the waiter
+    // or the attempt sees what the notifier did
+    atomic_fetch_add(&w->waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    unsigned seq = atomic_load(&w->seq);
+    if (attempt(arg)) {
+      atomic_fetch_sub(&w->waiters, 1);
+      break;
+    }
+    sleepOn(w, seq);
+    atomic_fetch_sub(&w->waiters, 1);
+  } while (!attempt(arg));
+  TRACE_EVENT(TRACE_WAIT_END, w->strategy);
+}
+
+static void wake(waiter *w, int n) {
+  TRACE_EVENT(TRACE_SIGNAL, n);
+  if (w->strategy == WAIT_FUTEX) {
+    atomic_fetch_add(&w->seq, 1);
+    futexWake(&w->seq, n);
+    return;
+  }
+  pthread_mutex_lock(&w->mut);
+  atomic_fetch_add(&w->seq, 1);
+  if (n == 1)
+    pthread_cond_signal(&w->cond);
+  else
+    pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->mut);
+}
+
+void waitNotify(waiter *w) {
+  if (w->strategy < WAIT_FUTEX)
+    return;
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&w->waiters, memory_order_relaxed) > 0)
+    wake(w, 1);
+}
+
+void waitNotifyAll(waiter *w) {
+  if (w->strategy < WAIT_FUTEX)
+    return;
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&w->waiters, memory_order_relaxed) > 0)
+    wake(w, INT_MAX);
+}
@@ -0,0 +1,143 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "trace.h"
+
+/**
+ * Everything that is written by different threads lives on its own cache
+ * line, so producers and consumers do not invalidate each other's lines.
+ */
+#define CACHE_LINE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+
+// Pauses before a blocked thread yields or sleeps
+#define SPIN_LIMIT 128
+
+typedef enum {
+  WAIT_SPIN,  // pause in a loop, never leaves the cpu
+  WAIT_YIELD, // SPIN_LIMIT pauses, then sched_yield
+  WAIT_FUTEX, // SPIN_LIMIT pauses, then sleep on a futex
+  WAIT_COND,  // sleep on a condition variable right away
+  WAIT_NUM_STRATEGIES
+} waitStrategy;
+
+extern const char *const waitNames[WAIT_NUM_STRATEGIES];
+
+/**
+ * Returns the strategy with that name, or -1
+ */
+int waitByName(const char *name);
+
+/**
+ * How the mutex of a locked backend deals with priorities. A PRIO_PROTECT
+ * mutex has the highest SCHED_FIFO priority as its ceiling, and every thread
+ * that locks it has to run under SCHED_FIFO.
+ */
+typedef enum {
+  LOCK_PLAIN,   // no protocol, a preempted holder blocks everyone
+  LOCK_INHERIT, // PTHREAD_PRIO_INHERIT
+  LOCK_PROTECT, // PTHREAD_PRIO_PROTECT
+  LOCK_NUM_PROTOCOLS
+} lockProtocol;
+
+extern const char *const lockNames[LOCK_NUM_PROTOCOLS];
+
+/**
+ * Returns the protocol with that name, or -1
+ */
+int lockByName(const char *name);
+
+/**
+ * Returns 0 or the error of pthread_mutex_init
+ */
+int mutexInit(pthread_mutex_t *mut, lockProtocol lock);
+
+/**
+ * The mutex and condition variable calls of the locked backends, as they
+ * show up in a trace
+ */
+static inline void mutexLock(pthread_mutex_t *mut) {
+  pthread_mutex_lock(mut);
+  TRACE_EVENT(TRACE_LOCK_ACQUIRE, 0);
+}
+
+static inline void mutexUnlock(pthread_mutex_t *mut) {
+  TRACE_EVENT(TRACE_LOCK_RELEASE, 0);
+  pthread_mutex_unlock(mut);
+}
+
+static inline void condWait(pthread_cond_t *cond, pthread_mutex_t *mut) {
+  TRACE_EVENT(TRACE_LOCK_RELEASE, 0);
+  TRACE_EVENT(TRACE_WAIT_START, 0);
+  pthread_cond_wait(cond, mut);
+  TRACE_EVENT(TRACE_WAIT_END, 0);
+  TRACE_EVENT(TRACE_LOCK_ACQUIRE, 0);
+}
+
+static inline void condSignal(pthread_cond_t *cond, bool all) {
+  TRACE_EVENT(TRACE_SIGNAL, all);
+  if (all)
+    pthread_cond_broadcast(cond);
+  else
+    pthread_cond_signal(cond);
+}
+
+/**
+ * An event count for one condition of a queue, e.g. not empty. Sleepers count
+ * themselves in waiters before they re-check the condition, so a notifier that
+ * sees no waiters skips the wake syscall without losing a wake-up.
+ */
+typedef struct {
+  atomic_uint seq CACHE_ALIGNED; // bumped by every wake
+  atomic_int waiters;
+  waitStrategy strategy;
+  pthread_mutex_t mut; // WAIT_COND only
+  pthread_cond_t cond;
+} waiter;
+
+void waiterInit(waiter *w, waitStrategy strategy);
+void waiterDestroy(waiter *w);
+
+/**
+ * Calls attempt(arg) until it returns true, waiting as the strategy says
+ * between the calls
+ */
+void waitFor(waiter *w, bool (*attempt)(void *), void *arg);
+
+/**
+ * Called after the condition may have become true. waitNotify wakes one
+ * sleeper and waitNotifyAll every sleeper.
+ */
+void waitNotify(waiter *w);
+void waitNotifyAll(waiter *w);
+
+/**
+ * Private futex wait and wake. futexWait returns at once if *addr != val.
+ */
+void futexWait(atomic_uint *addr, unsigned val);
+void futexWake(atomic_uint *addr, int n);
+
+/**
+ * Spin hint for busy waiting loops
+ */
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void backoff(int *spins) {
+  if (++*spins < SPIN_LIMIT)
+    cpuRelax();
+  else
+    sched_yield();
+}
+
+#endif
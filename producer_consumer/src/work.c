@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include "work.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+const char *const workNames[WORK_NUM_KERNELS] = {
+    [WORK_COMPUTE] = "compute", [WORK_STREAM] = "stream",
+    [WORK_CHASE] = "chase",     [WORK_SYSCALL] = "syscall",
+    [WORK_SLEEP] = "sleep",
+};
+
+const long workDefaultCosts[WORK_NUM_KERNELS] = {
+    [WORK_COMPUTE] = 10, [WORK_STREAM] = 4, [WORK_CHASE] = 100,
+    [WORK_SYSCALL] = 1,  [WORK_SLEEP] = 10,
+};
+
+_Thread_local uint64_t workSink;
+
+// Where the next stream and chase of the thread start, spread over the
+// working set on the first item
+static _Thread_local bool placed;
+static _Thread_local size_t streamAt;
+static _Thread_local uint32_t chaseAt;
+
+int workByName(const char *name) {
+  for (int i = 0; i < WORK_NUM_KERNELS; i++) {
+    if (strcmp(workNames[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Sattolo's shuffle gives a single cycle through every node
+static void chaseInit(uint32_t *next, long n) {
+  unsigned seed = 1;
+  for (long i = 0; i < n; i++)
+    next[i] = i;
+  for (long i = n - 1; i > 0; i--) {
+    long j = rand_r(&seed) % i;
+    uint32_t t = next[i];
+    next[i] = next[j];
+    next[j] = t;
+  }
+}
+
+bool workLoadInit(workLoad *w, workKernel kernel, long cost) {
+  w->kernel = kernel;
+  w->cost = cost > 0 ? cost : workDefaultCosts[kernel];
+  w->stream = NULL;
+  w->next = NULL;
+
+  if (kernel == WORK_STREAM) {
+    w->stream = (uint64_t *)malloc(WORK_STREAM_BYTES);
+    if (w->stream == NULL)
+      return false;
+    for (size_t i = 0; i < WORK_STREAM_BYTES / sizeof(uint64_t); i++)
+      w->stream[i] = i;
+  } else if (kernel == WORK_CHASE) {
+    w->next = (uint32_t *)malloc(WORK_CHASE_NODES * sizeof(uint32_t));
+    if (w->next == NULL)
+      return false;
+    chaseInit(w->next, WORK_CHASE_NODES);
+  }
+  return true;
+}
+
+void workLoadDestroy(workLoad *w) {
+  free(w->stream);
+  free(w->next);
+}
+
+void workRun(workLoad *w) {
+  uint64_t sum = 0;
+
+  if (!placed) {
+    uint64_t h = (uintptr_t)&workSink * 0x9e3779b97f4a7c15ULL;
+    streamAt = (h >> 32) % (WORK_STREAM_BYTES / sizeof(uint64_t));
+    chaseAt = (h >> 32) % WORK_CHASE_NODES;
+    placed = true;
+  }
+
+  switch (w->kernel) {
+  case WORK_COMPUTE: {
+    double count = 0;
+    for (long i = 0; i < w->cost; i++)
+      count += sin(i);
+    sum = (uint64_t)(int64_t)count;
+    break;
+  }
+  case WORK_STREAM: {
+    size_t words = WORK_STREAM_BYTES / sizeof(uint64_t);
+    for (long k = 0; k < w->cost * 1024 / (long)sizeof(uint64_t); k++) {
+      sum += w->stream[streamAt];
+      if (++streamAt == words)
+        streamAt = 0;
+    }
+    break;
+  }
+  case WORK_CHASE: {
+    uint32_t at = chaseAt;
+    for (long i = 0; i < w->cost; i++)
+      at = w->next[at];
+    chaseAt = at;
+    sum = at;
+    break;
+  }
+  case WORK_SYSCALL:
+    for (long i = 0; i < w->cost; i++)
+      sum += syscall(SYS_getppid);
+    break;
+  case WORK_SLEEP: {
+    struct timespec t = {w->cost / 1000000, w->cost % 1000000 * 1000};
+    while (nanosleep(&t, &t) != 0)
+      ;
+    break;
+  }
+  default:
+    break;
+  }
+
+  workSink += sum;
+}
@@ -0,0 +1,61 @@
+#ifndef WORK_H
+#define WORK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Working sets of the memory kernels, larger than the last level caches
+#define WORK_STREAM_BYTES (64L * 1024 * 1024)
+#define WORK_CHASE_NODES (4L * 1024 * 1024)
+
+/**
+ * What a consumer does for every item, and what one unit of cost is
+ */
+typedef enum {
+  WORK_COMPUTE, // one sin, cost 10 is the original workQueue
+  WORK_STREAM,  // reads one KiB sequentially
+  WORK_CHASE,   // one dependent load of a random cycle, a cache miss each
+  WORK_SYSCALL, // one getppid system call
+  WORK_SLEEP,   // sleeps one us, like waiting for I/O
+  WORK_NUM_KERNELS
+} workKernel;
+
+extern const char *const workNames[WORK_NUM_KERNELS];
+
+// Cost of an item when none is given
+extern const long workDefaultCosts[WORK_NUM_KERNELS];
+
+/**
+ * Returns the kernel with that name, or -1
+ */
+int workByName(const char *name);
+
+/**
+ * A kernel, its cost per item and the data of the memory kernels, shared
+ * read only by every consumer. Every thread streams and chases on from where
+ * its previous item stopped, so consecutive items do not hit a warm cache.
+ */
+typedef struct {
+  workKernel kernel;
+  long cost;
+  uint64_t *stream;
+  uint32_t *next; // the cycle of the chase
+} workLoad;
+
+/**
+ * cost 0 picks the default of the kernel. Returns false if the working set
+ * can not be allocated.
+ */
+bool workLoadInit(workLoad *w, workKernel kernel, long cost);
+void workLoadDestroy(workLoad *w);
+
+/**
+ * Runs the kernel once. The result is added to workSink, which the compiler
+ * has to assume someone reads, so it can not drop the work.
+ */
+void workRun(workLoad *w);
+
+extern _Thread_local uint64_t workSink;
+
+#endif